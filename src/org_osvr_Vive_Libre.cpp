@@ -24,6 +24,7 @@
  */
 
 #include <chrono>
+#include <cstdlib>
 #include <thread>
 #include <iostream>
 
@@ -31,6 +32,8 @@
 
 #include <osvr/PluginKit/PluginKit.h>
 #include <osvr/PluginKit/TrackerInterfaceC.h>
+#include <osvr/PluginKit/ButtonInterfaceC.h>
+#include <osvr/PluginKit/AnalogInterfaceC.h>
 
 #include "org_osvr_Vive_Libre_json.h"
 #include "vl_driver.h"
@@ -39,6 +42,17 @@
 
 static const auto PREFIX = "[vive-libre] ";
 
+// per controller
+static const uint8_t BUTTONS[] = {
+    vl_controller_button::TRIGGER,
+    vl_controller_button::TOUCH,
+    vl_controller_button::TOUCH_PRESS,
+    vl_controller_button::SYSTEM,
+    vl_controller_button::GRIP,
+    vl_controller_button::MENU,
+};
+#define BUTTON_COUNT (sizeof(BUTTONS) / sizeof(BUTTONS[0]))
+
 void vl_print(std::string s) {
     std::cout << PREFIX << s << std::endl;
 }
@@ -48,7 +62,10 @@ class TrackerDevice {
   private:
     osvr::pluginkit::DeviceToken m_dev;
     OSVR_TrackerDeviceInterface m_tracker;
+    OSVR_ButtonDeviceInterface m_button;
+    OSVR_AnalogDeviceInterface m_analog;
     vl_driver* vive;
+    bool distortion_announced = false;
 
   public:
     TrackerDevice(OSVR_PluginRegContext ctx, vl_driver* vive) {
@@ -60,6 +77,8 @@ class TrackerDevice {
 
         // configure tracker
         osvrDeviceTrackerConfigure(opts, &m_tracker);
+        osvrDeviceButtonConfigure(opts, &m_button, VL_WATCHMAN_CONTROLLERS * BUTTON_COUNT);
+        osvrDeviceAnalogConfigure(opts, &m_analog, VL_WATCHMAN_CONTROLLERS * VL_INPUT_AXIS_COUNT);
 
         // Create the device token with the options
         m_dev.initAsync(ctx, "Tracker", opts);
@@ -75,9 +94,44 @@ class TrackerDevice {
         vl_set_log_level(Level::INFO);
 
         vl_driver_start_hmd_imu_capture(vive, vl_driver_update_pose);
+
+        // Slow down while the headset is not worn.
+        vl_driver_start_hmd_mainboard_capture(vive, vl_driver_update_mainboard);
+
+        vl_driver_start_watchman_capture(vive, vl_driver_update_controller);
+
+        // Generated in the background, the device is up before it is
+        // done. The thread links the mesh the display config names.
+        vive->init_distortion();
+
+        // Poses for local readers next to OSVR, see vl_pose_shm.h.
+        const char* pose_shm = getenv(VL_POSE_EXPORT_ENV);
+        if (pose_shm)
+            vive->init_pose_export(pose_shm[0] == '/' ? pose_shm : VL_POSE_SHM_NAME);
+
+        // Correct the yaw drift when a base station is in view.
+        if (vive->init_heading_correction())
+            vl_driver_start_hmd_light_capture(vive, vl_driver_correct_heading);
     }
 
 
+    void send_input(const vl_input_event& event) {
+        if (event.type == vl_input_event_type::AXIS) {
+            OSVR_ChannelCount channel = event.controller * VL_INPUT_AXIS_COUNT + static_cast<size_t>(event.axis);
+            osvrDeviceAnalogSetValue(m_dev, m_analog, event.value, channel);
+            return;
+        }
+
+        for (size_t i = 0; i < BUTTON_COUNT; i++) {
+            if (BUTTONS[i] != event.button)
+                continue;
+            OSVR_ChannelCount channel = event.controller * BUTTON_COUNT + i;
+            osvrDeviceButtonSetValue(m_dev, m_button,
+                                     event.type == vl_input_event_type::PRESS ? OSVR_BUTTON_PRESSED : OSVR_BUTTON_NOT_PRESSED,
+                                     channel);
+        }
+    }
+
     OSVR_ReturnCode update() {
         OSVR_TimeValue now;
         osvrTimeValueGetNow(&now);
@@ -87,6 +141,21 @@ class TrackerDevice {
 
         vive->poll();
 
+        if (!distortion_announced && vive->distortion && vive->distortion->ready()) {
+            distortion_announced = true;
+            if (!vive->distortion->get_meshdata_path().empty())
+                vl_print("Distortion mesh in " + vive->distortion->get_meshdata_path() + ".");
+        }
+
+        // only what changed since the last update
+        vl_input_event event;
+        while (vive->input_events.pop(&event))
+            send_input(event);
+
+        // nothing changed while still
+        if (!vive->scheduler.publish_due())
+            return OSVR_RETURN_SUCCESS;
+
         if (vive->previous_ticks != 0)
             osvr::util::toQuat (vive->sensor_fusion->orientation, pose.rotation);
 
@@ -109,6 +178,7 @@ class HardwareDetection {
     }
     ~HardwareDetection() {
         vl_print("Shutting Down.");
+        vive->scheduler.print_stats();
         delete(this->vive);
     }
 
@@ -0,0 +1,66 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "vl_cache.h"
+#include "vl_log.h"
+
+static bool make_dir(const std::string& path) {
+    if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST)
+        return true;
+    vl_warn("Failed to create %s: %s", path.c_str(), strerror(errno));
+    return false;
+}
+
+std::string vl_cache_path(const std::string& file_name) {
+    std::string dir;
+
+    const char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if (xdg_cache_home && xdg_cache_home[0] == '/')
+        dir = xdg_cache_home;
+    else if (home && home[0] == '/')
+        dir = std::string(home) + "/.cache";
+    else
+        return "";
+
+    if (!make_dir(dir))
+        return "";
+
+    dir += "/vive-libre";
+    if (!make_dir(dir))
+        return "";
+
+    return dir + "/" + file_name;
+}
+
+std::string vl_cache_serial(const std::string& serial) {
+    // serials are plain ASCII, but keep the path sane anyway
+    std::string name;
+    for (char c : serial)
+        name += isalnum((unsigned char) c) ? c : '_';
+    return name;
+}
@@ -0,0 +1,32 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <string>
+
+// Path of a file in the directory for state kept across runs,
+// $XDG_CACHE_HOME/vive-libre or ~/.cache/vive-libre. The directory
+// is created on demand. Returns an empty string if there is no
+// usable directory.
+std::string vl_cache_path(const std::string& file_name);
+
+// A device serial as part of a file name, anything but letters and
+// digits replaced by '_'.
+std::string vl_cache_serial(const std::string& serial);
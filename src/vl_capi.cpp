@@ -0,0 +1,292 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include <Eigen/Geometry>
+
+#include "vl_capi.h"
+#include "vl_driver.h"
+#include "vl_log.h"
+
+// The payloads are handed out as they are stored in the driver.
+static_assert(sizeof(vl_imu_sample) == sizeof(vive_headset_imu_sample), "IMU sample layout");
+static_assert(offsetof(vl_imu_sample, time_ticks) == offsetof(vive_headset_imu_sample, time_ticks), "IMU sample layout");
+static_assert(offsetof(vl_imu_sample, seq) == offsetof(vive_headset_imu_sample, seq), "IMU sample layout");
+static_assert(sizeof(vl_light_pulse) == sizeof(vive_headset_lighthouse_pulse2), "light pulse layout");
+static_assert(offsetof(vl_light_pulse, timestamp) == offsetof(vive_headset_lighthouse_pulse2, timestamp), "light pulse layout");
+static_assert(sizeof(vl_controller_input) == sizeof(vl_input_event), "controller input layout");
+static_assert(offsetof(vl_controller_input, type) == offsetof(vl_input_event, type), "controller input layout");
+static_assert(offsetof(vl_controller_input, axis) == offsetof(vl_input_event, axis), "controller input layout");
+static_assert(offsetof(vl_controller_input, value) == offsetof(vl_input_event, value), "controller input layout");
+static_assert(sizeof(vl_headset_status) == sizeof(vl_mainboard_event), "headset status layout");
+static_assert(offsetof(vl_headset_status, value) == offsetof(vl_mainboard_event, value), "headset status layout");
+
+static_assert(VL_INPUT_AXIS == static_cast<int>(vl_input_event_type::AXIS), "input types");
+static_assert(VL_INPUT_AXIS_TRACKPAD_Y == static_cast<int>(vl_input_axis::TRACKPAD_Y), "input axes");
+static_assert(VL_HEADSET_LENS_SEPARATION == static_cast<int>(vl_mainboard_event_type::LENS_SEPARATION), "status types");
+
+// The driver is the base, so the capture callbacks find the context.
+struct vl_context : vl_driver {
+    vl_event_callback callback = nullptr;
+    void* user_data = nullptr;
+    uint32_t callback_streams = 0;
+
+    uint32_t streams = 0;
+    bool streaming = false;
+    std::thread thread;
+    std::atomic<bool> stopping { false };
+
+    // written on the driving thread, read from any
+    std::mutex pose_mutex;
+    vl_pose pose = {};
+    bool has_pose = false;
+
+    bool wants(uint32_t stream) const { return callback && (callback_streams & streams & stream); }
+
+    void deliver(uint32_t type, uint64_t time, const void* payload) {
+        vl_api_event event;
+        event.type = type;
+        event.reserved = 0;
+        event.time = time;
+        event.imu = static_cast<const vl_imu_sample*>(payload);
+        callback(&event, user_data);
+    }
+};
+
+static vl_context* get_context(vl_driver* driver) {
+    return static_cast<vl_context*>(driver);
+}
+
+static void capture_hmd_imu(uint8_t* buffer, int size, vl_driver* driver) {
+    vl_driver_update_pose(buffer, size, driver);
+    if (get_context(driver)->wants(VL_STREAM_HMD_IMU))
+        vl_driver_merge_hmd_imu(buffer, size, driver);
+}
+
+static void capture_hmd_light(uint8_t* buffer, int size, vl_driver* driver) {
+    if (driver->heading)
+        vl_driver_correct_heading(buffer, size, driver);
+    if (get_context(driver)->wants(VL_STREAM_HMD_LIGHT))
+        vl_driver_merge_hmd_light(buffer, size, driver);
+}
+
+// The queue is only filled and drained on this thread.
+static void capture_controller(uint8_t* buffer, int size, vl_driver* driver) {
+    vl_context* context = get_context(driver);
+    vl_driver_update_controller(buffer, size, driver);
+
+    vl_input_event event;
+    while (context->input_events.pop(&event))
+        if (context->wants(VL_STREAM_CONTROLLERS))
+            context->deliver(VL_EVENT_CONTROLLER_INPUT, event.time, &event);
+}
+
+static void stop_captures(vl_context* context) {
+    vl_driver_stop_hmd_imu_capture(context);
+    vl_driver_stop_hmd_light_capture(context);
+    vl_driver_stop_watchman_capture(context);
+    vl_driver_stop_hmd_mainboard_capture(context);
+
+    // the cancelled transfers still complete
+    while (context->is_capturing())
+        if (!context->poll())
+            break;
+
+    // events still waiting for the other streams
+    if (context->event_merge)
+        context->event_merge->flush();
+}
+
+static void run(vl_context* context) {
+    while (!context->stopping)
+        if (!context->poll())
+            break;
+    stop_captures(context);
+}
+
+unsigned vl_api_version(void) {
+    return VL_API_VERSION;
+}
+
+int vl_open(unsigned index, vl_context** context) {
+    if (!context)
+        return VL_ERROR_INVALID;
+
+    vl_context* vive = new (std::nothrow) vl_context();
+    if (!vive)
+        return VL_ERROR;
+
+    if (!vive->init_devices(index)) {
+        delete vive;
+        return VL_ERROR_NO_DEVICE;
+    }
+
+    // Not an issue, the pose works without it.
+    vive->init_heading_correction();
+
+    vive->pose_sink = [vive](const vl_pose& pose) {
+        std::lock_guard<std::mutex> lock(vive->pose_mutex);
+        vive->pose = pose;
+        vive->has_pose = true;
+    };
+
+    vive->mainboard_sink = [vive](const vl_mainboard_event& event) {
+        if (vive->wants(VL_STREAM_HEADSET_STATUS))
+            vive->deliver(VL_EVENT_HEADSET_STATUS, 0, &event);
+    };
+
+    *context = vive;
+    return VL_OK;
+}
+
+void vl_close(vl_context* context) {
+    if (!context)
+        return;
+    vl_stop(context);
+    delete context;
+}
+
+int vl_set_callback(vl_context* context, uint32_t mask, vl_event_callback callback, void* user_data) {
+    if (!context || (mask & ~VL_STREAM_ALL))
+        return VL_ERROR_INVALID;
+    if (context->streaming)
+        return VL_ERROR_BUSY;
+
+    context->callback = callback;
+    context->user_data = user_data;
+    context->callback_streams = mask;
+    return VL_OK;
+}
+
+int vl_start(vl_context* context, uint32_t streams, int own_thread) {
+    if (!context || (streams & ~VL_STREAM_ALL))
+        return VL_ERROR_INVALID;
+    if (context->streaming)
+        return VL_ERROR_BUSY;
+
+    // the pose needs it
+    context->streams = streams | VL_STREAM_HMD_IMU;
+
+    // The headset streams arrive in time order, with pointers into the
+    // merge buffer.
+    if (context->wants(VL_STREAM_HMD_IMU | VL_STREAM_HMD_LIGHT)) {
+        context->init_event_merge([context](const vl_event& event) {
+            if (event.stream == vl_event_stream::HMD_IMU)
+                context->deliver(VL_EVENT_IMU, event.time, &event.imu);
+            else if (event.stream == vl_event_stream::HMD_LIGHT)
+                context->deliver(VL_EVENT_LIGHT, event.time, &event.light);
+        });
+    } else {
+        context->event_merge.reset();
+    }
+
+    bool success = vl_driver_start_hmd_imu_capture(context, capture_hmd_imu);
+
+    bool light = (streams & VL_STREAM_HMD_LIGHT) || context->heading;
+    if (success && light)
+        success = vl_driver_start_hmd_light_capture(context, capture_hmd_light);
+
+    if (success && (streams & VL_STREAM_CONTROLLERS))
+        success = vl_driver_start_watchman_capture(context, capture_controller);
+
+    if (success && (streams & VL_STREAM_HEADSET_STATUS))
+        success = vl_driver_start_hmd_mainboard_capture(context, vl_driver_update_mainboard);
+
+    if (!success) {
+        vl_error("Failed to start the streams.");
+        stop_captures(context);
+        return VL_ERROR;
+    }
+
+    context->streaming = true;
+    if (own_thread) {
+        context->stopping = false;
+        context->thread = std::thread(run, context);
+    }
+    return VL_OK;
+}
+
+int vl_stop(vl_context* context) {
+    if (!context)
+        return VL_ERROR_INVALID;
+    if (!context->streaming)
+        return VL_OK;
+
+    if (context->thread.joinable()) {
+        context->stopping = true;
+        context->thread.join();
+    } else {
+        stop_captures(context);
+    }
+
+    context->streaming = false;
+    return VL_OK;
+}
+
+int vl_poll(vl_context* context) {
+    if (!context || !context->streaming)
+        return VL_ERROR_INVALID;
+    if (context->thread.joinable())
+        return VL_ERROR_BUSY;
+    return context->poll() ? VL_OK : VL_ERROR;
+}
+
+int vl_get_pose(vl_context* context, vl_pose* pose) {
+    if (!context || !pose)
+        return VL_ERROR_INVALID;
+
+    std::lock_guard<std::mutex> lock(context->pose_mutex);
+    if (!context->has_pose)
+        return VL_ERROR_NO_DATA;
+    *pose = context->pose;
+    return VL_OK;
+}
+
+// Rotated in the headset frame, like vl_fusion integrates the gyro.
+int vl_predict_pose(vl_context* context, uint64_t host_time_ns, vl_pose* pose) {
+    int ret = vl_get_pose(context, pose);
+    if (ret != VL_OK)
+        return ret;
+
+    if (host_time_ns <= pose->host_time_ns)
+        return VL_OK;
+    uint64_t ahead = std::min<uint64_t>(host_time_ns - pose->host_time_ns, VL_MAX_PREDICTION_NS);
+
+    Eigen::Vector3d w(pose->angular_velocity[0], pose->angular_velocity[1], pose->angular_velocity[2]);
+    double angle = w.norm() * ahead * 1e-9;
+    if (angle <= 0)
+        return VL_OK;
+
+    Eigen::Quaterniond orientation(pose->orientation[0], pose->orientation[1],
+                                   pose->orientation[2], pose->orientation[3]);
+    orientation = (orientation * Eigen::Quaterniond(Eigen::AngleAxisd(angle, w.normalized()))).normalized();
+
+    pose->orientation[0] = orientation.w();
+    pose->orientation[1] = orientation.x();
+    pose->orientation[2] = orientation.y();
+    pose->orientation[3] = orientation.z();
+    pose->host_time_ns += ahead;
+    return VL_OK;
+}
@@ -0,0 +1,191 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+// C API of the vive-libre library, stable ABI
+//
+// For hosts without OSVR. A context owns one headset with its
+// controllers:
+//
+//	vl_context* vive;
+//	if (vl_open(0, &vive) != VL_OK)
+//		return;
+//	vl_set_callback(vive, VL_STREAM_CONTROLLERS, on_event, user_data);
+//	vl_start(vive, VL_STREAM_ALL, 1);
+//	...
+//	vl_predict_pose(vive, display_time_ns, &pose);
+//	...
+//	vl_close(vive);
+//
+// Events are pushed to one callback. The payload pointers point into
+// the driver and are only valid during the callback, nothing is
+// copied or allocated per event. The pose is pulled at any time from
+// any thread.
+//
+// Callbacks run on the thread that drives the context: the one calling
+// vl_poll(), or the context's own thread, see vl_start(). They must not
+// call vl_start(), vl_stop(), vl_set_callback() or vl_close().
+//
+// The header is C11 and C++. Later versions only add functions and
+// append to structs handed in by pointer.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "vl_pose_shm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VL_API_VERSION 1
+
+// The library is built with hidden visibility, only these are exported.
+#if defined(__GNUC__)
+#define VL_EXPORT __attribute__((visibility("default")))
+#else
+#define VL_EXPORT
+#endif
+
+// return values
+#define VL_OK 0
+#define VL_ERROR -1
+#define VL_ERROR_NO_DEVICE -2
+#define VL_ERROR_INVALID -3
+// not while streaming, or while the context has its own thread
+#define VL_ERROR_BUSY -4
+// no pose yet
+#define VL_ERROR_NO_DATA -5
+
+// streams, for vl_start() and vl_set_callback()
+#define VL_STREAM_HMD_IMU (1u << 0)
+#define VL_STREAM_HMD_LIGHT (1u << 1)
+#define VL_STREAM_CONTROLLERS (1u << 2)
+#define VL_STREAM_HEADSET_STATUS (1u << 3)
+#define VL_STREAM_ALL 0xfu
+
+// Predictions further ahead are clamped to this.
+#define VL_MAX_PREDICTION_NS 100000000
+
+// the same as struct vl_pose_shm_sample
+typedef struct vl_pose_shm_sample vl_pose;
+
+typedef struct vl_context vl_context;
+
+// One IMU sample as the headset sends it, raw sensor units.
+typedef struct vl_imu_sample {
+    int16_t accel[3];
+    int16_t gyro[3];
+    uint32_t time_ticks;
+    uint8_t seq;
+} __attribute__((packed)) vl_imu_sample;
+
+// One light pulse seen by a headset sensor.
+typedef struct vl_light_pulse {
+    uint8_t sensor_id;
+    uint16_t length;
+    uint32_t timestamp;
+} __attribute__((packed)) vl_light_pulse;
+
+// vl_controller_input.type
+#define VL_INPUT_PRESS 0
+#define VL_INPUT_RELEASE 1
+#define VL_INPUT_AXIS 2
+
+// vl_controller_input.axis
+#define VL_INPUT_AXIS_TRIGGER 0
+#define VL_INPUT_AXIS_TRACKPAD_X 1
+#define VL_INPUT_AXIS_TRACKPAD_Y 2
+
+// A change of a controller button or axis.
+typedef struct vl_controller_input {
+    uint64_t time;
+    uint8_t controller;
+    uint8_t type;
+    // button flag for PRESS and RELEASE
+    uint8_t button;
+    uint8_t axis;
+    float value;
+} vl_controller_input;
+
+// vl_headset_status.type
+#define VL_HEADSET_WORN 0
+#define VL_HEADSET_REMOVED 1
+#define VL_HEADSET_BUTTON 2
+// value in 1/100 mm
+#define VL_HEADSET_IPD 3
+#define VL_HEADSET_LENS_SEPARATION 4
+
+typedef struct vl_headset_status {
+    uint8_t type;
+    uint16_t value;
+} vl_headset_status;
+
+// vl_api_event.type
+#define VL_EVENT_IMU 0
+#define VL_EVENT_LIGHT 1
+#define VL_EVENT_CONTROLLER_INPUT 2
+#define VL_EVENT_HEADSET_STATUS 3
+
+typedef struct vl_api_event {
+    uint32_t type;
+    uint32_t reserved;
+    // 48 MHz device ticks, unwrapped to 64 bit. The headset streams are
+    // merged in time order, the controllers run on their own clocks.
+    // 0 for the headset status.
+    uint64_t time;
+    union {
+        const vl_imu_sample* imu;
+        const vl_light_pulse* light;
+        const vl_controller_input* input;
+        const vl_headset_status* status;
+    };
+} vl_api_event;
+
+typedef void (*vl_event_callback)(const vl_api_event* event, void* user_data);
+
+VL_EXPORT unsigned vl_api_version(void);
+
+// Open the index-th headset with its controllers.
+VL_EXPORT int vl_open(unsigned index, vl_context** context);
+// Stops streaming first.
+VL_EXPORT void vl_close(vl_context* context);
+
+// Events of the streams in mask go to callback, NULL for none. Only
+// while not streaming.
+VL_EXPORT int vl_set_callback(vl_context* context, uint32_t mask, vl_event_callback callback, void* user_data);
+
+// Start the streams. The IMU always runs, for the pose. With
+// own_thread the context drives itself, otherwise call vl_poll().
+VL_EXPORT int vl_start(vl_context* context, uint32_t streams, int own_thread);
+VL_EXPORT int vl_stop(vl_context* context);
+
+// Wait for and handle the next device reports, running the callbacks
+// on this thread.
+VL_EXPORT int vl_poll(vl_context* context);
+
+// The latest fused pose.
+VL_EXPORT int vl_get_pose(vl_context* context, vl_pose* pose);
+// The latest pose rotated ahead to host_time_ns, CLOCK_MONOTONIC, at
+// its angular velocity.
+VL_EXPORT int vl_predict_pose(vl_context* context, uint64_t host_time_ns, vl_pose* pose);
+
+#ifdef __cplusplus
+}
+#endif
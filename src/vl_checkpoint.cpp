@@ -0,0 +1,140 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "vl_cache.h"
+#include "vl_checkpoint.h"
+#include "vl_log.h"
+
+#define CHECKPOINT_MAGIC "VLFS"
+
+// orientation w x y z, gyro bias
+#define CHECKPOINT_VALUES 7
+
+struct checkpoint_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+} __attribute__((packed));
+
+static std::string checkpoint_path(const std::string& serial) {
+    return vl_cache_path("fusion-" + vl_cache_serial(serial) + ".bin");
+}
+
+bool vl_checkpoint_load(const std::string& serial, vl_fusion_state* state) {
+    std::string path = checkpoint_path(serial);
+    if (path.empty())
+        return false;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    checkpoint_header header;
+    double values[CHECKPOINT_VALUES];
+    file.read((char*) &header, sizeof(header));
+    if (!file.good() || memcmp(header.magic, CHECKPOINT_MAGIC, 4) != 0 ||
+            header.version != VL_CHECKPOINT_VERSION || header.count != CHECKPOINT_VALUES) {
+        vl_warn("Ignoring fusion checkpoint %s of another version.", path.c_str());
+        return false;
+    }
+
+    file.read((char*) values, sizeof(values));
+    if (!file.good()) {
+        vl_warn("Fusion checkpoint %s is truncated.", path.c_str());
+        return false;
+    }
+
+    for (double value : values) {
+        if (!std::isfinite(value)) {
+            vl_warn("Fusion checkpoint %s is broken.", path.c_str());
+            return false;
+        }
+    }
+
+    state->orientation = Eigen::Quaterniond(values[0], values[1], values[2], values[3]);
+    state->gyro_bias = Eigen::Vector3d(values[4], values[5], values[6]);
+
+    return true;
+}
+
+bool vl_checkpoint_save(const std::string& serial, const vl_fusion_state& state) {
+    // Nothing learned yet, keep the previous checkpoint.
+    if (!state.started)
+        return false;
+
+    std::string path = checkpoint_path(serial);
+    if (path.empty())
+        return false;
+
+    checkpoint_header header;
+    memcpy(header.magic, CHECKPOINT_MAGIC, 4);
+    header.version = VL_CHECKPOINT_VERSION;
+    header.count = CHECKPOINT_VALUES;
+
+    double values[CHECKPOINT_VALUES] = {
+        state.orientation.w(), state.orientation.x(), state.orientation.y(), state.orientation.z(),
+        state.gyro_bias.x(), state.gyro_bias.y(), state.gyro_bias.z(),
+    };
+
+    // Write a new file and move it in place, as for the room setups.
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary);
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) values, sizeof(values));
+    file.close();
+
+    if (!file.good() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        vl_warn("Failed to write fusion checkpoint %s.", path.c_str());
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+vl_fusion_checkpoint::vl_fusion_checkpoint(vl_fusion* fusion, const std::string& serial)
+    : fusion(fusion), serial(serial) {
+    thread = std::thread(&vl_fusion_checkpoint::run, this);
+}
+
+vl_fusion_checkpoint::~vl_fusion_checkpoint() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    stop_condition.notify_one();
+    thread.join();
+
+    vl_checkpoint_save(serial, fusion->get_state());
+}
+
+void vl_fusion_checkpoint::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stop_condition.wait_for(lock, VL_CHECKPOINT_PERIOD, [this] { return stopping; })) {
+        lock.unlock();
+        // Only a short lock on the fusion, the file is written after.
+        vl_checkpoint_save(serial, fusion->get_state());
+        lock.lock();
+    }
+}
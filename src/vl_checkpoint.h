@@ -0,0 +1,56 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "vl_fusion.h"
+
+#define VL_CHECKPOINT_VERSION 2
+#define VL_CHECKPOINT_PERIOD std::chrono::seconds(10)
+
+// Fusion state of one headset in the cache directory, fusion-<serial>.bin
+//
+// A small binary file: magic "VLFS", version, then the state as doubles
+// in the byte order of the host, the cache is not shared between
+// machines. Files of another version are ignored.
+bool vl_checkpoint_load(const std::string& serial, vl_fusion_state* state);
+bool vl_checkpoint_save(const std::string& serial, const vl_fusion_state& state);
+
+// Saves the fusion state every VL_CHECKPOINT_PERIOD from its own thread,
+// and once more when destroyed. The fusion must outlive it.
+class vl_fusion_checkpoint {
+    vl_fusion* fusion;
+    std::string serial;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable stop_condition;
+    bool stopping = false;
+
+    void run();
+
+public:
+    vl_fusion_checkpoint(vl_fusion* fusion, const std::string& serial);
+    ~vl_fusion_checkpoint();
+};
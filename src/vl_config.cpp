@@ -14,6 +14,8 @@
 #include <cstdint>
 
 #include <libusb.h>
+#include <json/reader.h>
+#include <json/value.h>
 
 #include "vl_config.h"
 #include "vl_synchronous.h"
@@ -106,3 +108,88 @@ char *vl_get_config(vl_device& device, uint16_t interface)
 
     return (char *) realloc(config_json, strm.total_out + 1);
 }
+
+static vl_model_points parse_points(const Json::Value& points) {
+    vl_model_points result;
+    result.reserve(points.size());
+    for (const Json::Value& point : points)
+        result.push_back(Eigen::Vector3d(point[0].asDouble(), point[1].asDouble(), point[2].asDouble()));
+    return result;
+}
+
+static bool parse_config(const char* config, Json::Value* root)
+{
+    if (!config || !config[0])
+        return false;
+
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    std::string errs;
+    if (!reader->parse(config, config + strlen(config), root, &errs)) {
+        vl_error("Failed to parse configuration: %s", errs.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool vl_config_sensor_model(const char* config, vl_model_points* points, vl_model_normals* normals)
+{
+    Json::Value root;
+    if (!parse_config(config, &root))
+        return false;
+
+    const Json::Value& lighthouse_config = root["lighthouse_config"];
+    *points = parse_points(lighthouse_config["modelPoints"]);
+    *normals = parse_points(lighthouse_config["modelNormals"]);
+
+    if (normals->size() != points->size())
+        normals->clear();
+
+    return !points->empty();
+}
+
+static bool parse_coefficients(const Json::Value& distortion, vl_distortion_coefficients* coefficients)
+{
+    const Json::Value& k = distortion["coeffs"];
+    if (!k.isArray() || k.size() < coefficients->k.size())
+        return false;
+
+    if (distortion["type"].asString() != "DISTORT_DPOLY3")
+        vl_warn("Unknown distortion type %s, using it as DISTORT_DPOLY3.", distortion["type"].asCString());
+
+    coefficients->center_x = distortion["center_x"].asFloat();
+    coefficients->center_y = distortion["center_y"].asFloat();
+    for (unsigned i = 0; i < coefficients->k.size(); i++)
+        coefficients->k[i] = k[i].asFloat();
+
+    return true;
+}
+
+bool vl_config_distortion(const char* config, vl_distortion_model* model)
+{
+    Json::Value root;
+    if (!parse_config(config, &root))
+        return false;
+
+    static const char* channel_keys[VL_DISTORTION_CHANNELS] = {
+        "distortion_red", "distortion", "distortion_blue"
+    };
+
+    const Json::Value& eyes = root["tracking_to_eye_transform"];
+    if (!eyes.isArray() || eyes.size() != VL_DISTORTION_EYES)
+        return false;
+
+    for (int eye = 0; eye < VL_DISTORTION_EYES; eye++) {
+        vl_distortion_eye_model& eye_model = (*model)[eye];
+        for (int channel = 0; channel < VL_DISTORTION_CHANNELS; channel++)
+            if (!parse_coefficients(eyes[eye][channel_keys[channel]], &eye_model.channels[channel]))
+                return false;
+
+        eye_model.grow = eyes[eye]["grow_for_undistort"].asFloat();
+        if (eyes[eye].isMember("undistort_r2_cutoff"))
+            eye_model.r2_cutoff = eyes[eye]["undistort_r2_cutoff"].asFloat();
+    }
+
+    return true;
+}
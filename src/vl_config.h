@@ -8,6 +8,16 @@
 
 #include <cstdint>
 
+#include "vl_distortion.h"
 #include "vl_driver.h"
+#include "vl_visibility.h"
 
 char *vl_get_config(vl_device& device, uint16_t interface);
+
+// Sensor positions and normals from the lighthouse_config section of
+// a device config. normals is left empty if the config has none.
+bool vl_config_sensor_model(const char* config, vl_model_points* points, vl_model_normals* normals);
+
+// Lens model of both eyes from the tracking_to_eye_transform section,
+// the green channel is the plain distortion.
+bool vl_config_distortion(const char* config, vl_distortion_model* model);
@@ -0,0 +1,375 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "vl_daemon.h"
+#include "vl_log.h"
+
+// Abstract namespace address of name, 0 if it is too long.
+static socklen_t abstract_address(const std::string& name, sockaddr_un* addr) {
+    if (name.size() + 1 > sizeof(addr->sun_path))
+        return 0;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path + 1, name.data(), name.size());
+    return offsetof(sockaddr_un, sun_path) + 1 + name.size();
+}
+
+vl_daemon_subscription vl_daemon_subscribe(uint32_t topics, uint32_t max_batch, uint32_t max_delay_us) {
+    vl_daemon_subscription subscription;
+    subscription.magic = VL_DAEMON_MAGIC;
+    subscription.version = VL_DAEMON_VERSION;
+    subscription.topics = topics;
+    subscription.max_batch = max_batch;
+    subscription.max_delay_us = max_delay_us;
+    return subscription;
+}
+
+const char* vl_daemon_topic_name(vl_daemon_topic topic) {
+    switch (topic) {
+    case vl_daemon_topic::HMD_IMU:
+        return "imu";
+    case vl_daemon_topic::HMD_LIGHT:
+        return "light";
+    case vl_daemon_topic::WATCHMAN1:
+        return "controller1";
+    case vl_daemon_topic::WATCHMAN2:
+        return "controller2";
+    case vl_daemon_topic::MAINBOARD:
+        return "mainboard";
+    default:
+        return "unknown";
+    }
+}
+
+vl_daemon_server::~vl_daemon_server() {
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake();
+        thread.join();
+    }
+
+    for (const client& c : clients)
+        close(c.fd);
+    if (listen_fd >= 0)
+        close(listen_fd);
+    if (wake_fd >= 0)
+        close(wake_fd);
+}
+
+bool vl_daemon_server::start(const std::string& name) {
+    sockaddr_un addr;
+    socklen_t length = abstract_address(name, &addr);
+    if (length == 0) {
+        vl_error("Socket name %s is too long.", name.c_str());
+        return false;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (const sockaddr*) &addr, length) != 0 ||
+            listen(listen_fd, 4) != 0) {
+        if (errno == EADDRINUSE)
+            vl_error("Another daemon is running on %s.", name.c_str());
+        else
+            vl_error("Failed to listen on %s: %s", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        vl_error("Failed to create an eventfd: %s", strerror(errno));
+        return false;
+    }
+
+    thread = std::thread(&vl_daemon_server::run, this);
+    vl_info("Serving events on %s.", name.c_str());
+
+    return true;
+}
+
+void vl_daemon_server::wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        vl_debug("eventfd write failed: %s", strerror(errno));
+}
+
+void vl_daemon_server::accept_client() {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0)
+        return;
+
+    ucred cred;
+    socklen_t cred_size = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_size) != 0 || cred.uid != getuid()) {
+        vl_warn("Refused a client of another user.");
+        close(fd);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (clients.size() >= VL_DAEMON_MAX_CLIENTS) {
+        vl_warn("Refused client %d, already %d clients.", cred.pid, VL_DAEMON_MAX_CLIENTS);
+        close(fd);
+        return;
+    }
+
+    client c = {};
+    c.fd = fd;
+    c.pid = cred.pid;
+    // nothing until the first subscription
+    c.subscription = vl_daemon_subscribe(0);
+    c.batch.reserve(VL_DAEMON_MAX_BATCH);
+    clients.push_back(std::move(c));
+    vl_info("Client %d attached.", cred.pid);
+}
+
+void vl_daemon_server::read_subscription(client& c) {
+    vl_daemon_subscription subscription;
+    ssize_t size = recv(c.fd, &subscription, sizeof(subscription), MSG_DONTWAIT);
+    if (size < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if (size != sizeof(subscription) || subscription.magic != VL_DAEMON_MAGIC ||
+            subscription.version != VL_DAEMON_VERSION) {
+        if (size != 0)
+            vl_warn("Dropping client %d, it speaks another protocol version.", c.pid);
+        c.closed = true;
+        return;
+    }
+
+    // The pending records were asked for, send them as they were.
+    flush(c);
+
+    subscription.max_batch = std::min<uint32_t>(std::max<uint32_t>(subscription.max_batch, 1), VL_DAEMON_MAX_BATCH);
+    subscription.topics &= VL_DAEMON_ALL_TOPICS;
+    c.subscription = subscription;
+    vl_debug("Client %d subscribed to 0x%02x, batches of %u within %u us.", c.pid,
+             subscription.topics, subscription.max_batch, subscription.max_delay_us);
+}
+
+void vl_daemon_server::flush(client& c) {
+    if (c.batch.empty() || c.closed)
+        return;
+
+    vl_daemon_batch_header header = {};
+    header.magic = VL_DAEMON_MAGIC;
+    header.count = c.batch.size();
+    header.dropped = c.dropped;
+
+    iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = c.batch.data();
+    iov[1].iov_len = c.batch.size() * sizeof(vl_daemon_record);
+
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (sendmsg(c.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+        c.dropped = 0;
+    else if (errno == EAGAIN || errno == ENOBUFS)
+        c.dropped += c.batch.size();
+    else
+        c.closed = true;
+
+    c.batch.clear();
+}
+
+void vl_daemon_server::push(client& c, const vl_daemon_record& record) {
+    c.batch.push_back(record);
+    if (c.batch.size() == 1 && c.subscription.max_delay_us > 0)
+        c.deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(c.subscription.max_delay_us);
+    if (c.batch.size() >= c.subscription.max_batch || c.subscription.max_delay_us == 0)
+        flush(c);
+}
+
+void vl_daemon_server::broadcast(const vl_daemon_record& record) {
+    const uint32_t bit = 1u << static_cast<unsigned>(record.topic);
+    bool started = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (client& c : clients) {
+            if (c.closed || !(c.subscription.topics & bit))
+                continue;
+            push(c, record);
+            started |= c.batch.size() == 1;
+        }
+    }
+
+    // for the thread to pick up the new deadline
+    if (started)
+        wake();
+}
+
+// Records go out as they are, value initialized so no stack bytes
+// leave in the unused union part.
+void vl_daemon_server::publish(const vl_event& event) {
+    vl_daemon_record record = {};
+    record.topic = static_cast<vl_daemon_topic>(event.stream);
+    record.event = event;
+    broadcast(record);
+}
+
+void vl_daemon_server::publish(const vl_mainboard_event& event) {
+    vl_daemon_record record = {};
+    record.topic = vl_daemon_topic::MAINBOARD;
+    record.mainboard = event;
+    broadcast(record);
+}
+
+// Only this thread adds and removes clients, so their indices hold
+// while it polls.
+void vl_daemon_server::run() {
+    std::vector<pollfd> fds;
+    while (true) {
+        timespec timeout_ts;
+        timespec* timeout = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+                return;
+
+            auto gone = std::remove_if(clients.begin(), clients.end(), [](const client& c) {
+                if (c.closed) {
+                    vl_info("Client %d detached.", c.pid);
+                    close(c.fd);
+                }
+                return c.closed;
+            });
+            clients.erase(gone, clients.end());
+
+            fds.clear();
+            fds.push_back({ wake_fd, POLLIN, 0 });
+            fds.push_back({ listen_fd, POLLIN, 0 });
+
+            auto now = std::chrono::steady_clock::now();
+            auto next = std::chrono::steady_clock::time_point::max();
+            for (client& c : clients) {
+                fds.push_back({ c.fd, POLLIN, 0 });
+                if (!c.batch.empty() && c.deadline <= now)
+                    flush(c);
+                if (!c.batch.empty())
+                    next = std::min(next, c.deadline);
+            }
+
+            if (next != std::chrono::steady_clock::time_point::max()) {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(next - now).count();
+                ns = std::max<decltype(ns)>(ns, 0);
+                timeout_ts.tv_sec = ns / 1000000000;
+                timeout_ts.tv_nsec = ns % 1000000000;
+                timeout = &timeout_ts;
+            }
+        }
+
+        if (ppoll(fds.data(), fds.size(), timeout, nullptr) < 0) {
+            if (errno == EINTR)
+                continue;
+            vl_error("Polling the clients failed: %s", strerror(errno));
+            return;
+        }
+
+        if (fds[0].revents) {
+            uint64_t count;
+            if (read(wake_fd, &count, sizeof(count)) < 0)
+                vl_debug("eventfd read failed: %s", strerror(errno));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 2; i < fds.size(); i++) {
+                client& c = clients[i - 2];
+                if (fds[i].revents & POLLIN)
+                    read_subscription(c);
+                else if (fds[i].revents)
+                    c.closed = true;
+            }
+        }
+
+        if (fds[1].revents & POLLIN)
+            accept_client();
+    }
+}
+
+vl_daemon_client::~vl_daemon_client() {
+    if (fd >= 0)
+        close(fd);
+}
+
+bool vl_daemon_client::connect(const vl_daemon_subscription& subscription, const std::string& name) {
+    sockaddr_un addr;
+    socklen_t length = abstract_address(name, &addr);
+    if (length == 0)
+        return false;
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, (const sockaddr*) &addr, length) != 0) {
+        vl_error("No daemon on %s: %s", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    buffer.resize(sizeof(vl_daemon_batch_header) + VL_DAEMON_MAX_BATCH * sizeof(vl_daemon_record));
+
+    return subscribe(subscription);
+}
+
+bool vl_daemon_client::subscribe(const vl_daemon_subscription& subscription) {
+    return send(fd, &subscription, sizeof(subscription), MSG_NOSIGNAL) == sizeof(subscription);
+}
+
+bool vl_daemon_client::receive(const vl_daemon_sink& sink, uint32_t* dropped) {
+    ssize_t size = recv(fd, buffer.data(), buffer.size(), 0);
+    if (size < 0 && errno == EINTR)
+        return true;
+    if (size <= 0)
+        return false;
+
+    vl_daemon_batch_header header;
+    memcpy(&header, buffer.data(), std::min<size_t>(size, sizeof(header)));
+    if ((size_t) size < sizeof(header) || header.magic != VL_DAEMON_MAGIC ||
+            (size_t) size != sizeof(header) + header.count * sizeof(vl_daemon_record)) {
+        vl_error("Malformed batch of %zd bytes from the daemon.", size);
+        return false;
+    }
+
+    if (dropped)
+        *dropped = header.dropped;
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        vl_daemon_record record;
+        memcpy(&record, buffer.data() + sizeof(header) + i * sizeof(record), sizeof(record));
+        sink(record);
+    }
+
+    return true;
+}
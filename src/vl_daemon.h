@@ -0,0 +1,174 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "vl_event_merge.h"
+#include "vl_mainboard.h"
+
+// Event daemon for local clients
+//
+// One process owns the devices and broadcasts the merged events, see
+// vl_event_merge, and the mainboard events over the abstract unix
+// socket VL_DAEMON_SOCKET_NAME. The socket is SOCK_SEQPACKET, so
+// every message arrives whole:
+//
+//	client: vl_daemon_subscription, again at any time to change it
+//	daemon: vl_daemon_batch_header and count vl_daemon_record
+//
+// Nothing is sent before the first subscription. The daemon never
+// waits for a client: a batch that does not fit into the socket buffer
+// is dropped and counted in the next one that does. Only clients of the
+// same user are accepted. The records are the structs of this build,
+// the version guards against mixing builds.
+
+#define VL_DAEMON_SOCKET_NAME "/vive-libre-events"
+#define VL_DAEMON_MAGIC 0x53444c56 // "VLDS"
+#define VL_DAEMON_VERSION 1
+#define VL_DAEMON_MAX_CLIENTS 16
+// records per batch at most
+#define VL_DAEMON_MAX_BATCH 256
+
+// The merged streams and the mainboard.
+enum class vl_daemon_topic : uint8_t {
+    HMD_IMU,
+    HMD_LIGHT,
+    WATCHMAN1,
+    WATCHMAN2,
+    MAINBOARD,
+    COUNT,
+};
+
+static_assert(static_cast<int>(vl_daemon_topic::WATCHMAN2) == static_cast<int>(vl_event_stream::WATCHMAN2),
+              "a stream is the topic of the same value");
+
+#define VL_DAEMON_TOPIC_BIT(topic) (1u << static_cast<unsigned>(vl_daemon_topic::topic))
+#define VL_DAEMON_ALL_TOPICS ((1u << static_cast<unsigned>(vl_daemon_topic::COUNT)) - 1)
+
+struct vl_daemon_subscription {
+    uint32_t magic;
+    uint32_t version;
+    // VL_DAEMON_TOPIC_BIT mask, 0 pauses
+    uint32_t topics;
+    // records per batch, 1 to VL_DAEMON_MAX_BATCH
+    uint32_t max_batch;
+    // a started batch goes out after this at the latest, 0 sends every
+    // record at once
+    uint32_t max_delay_us;
+};
+
+vl_daemon_subscription vl_daemon_subscribe(uint32_t topics, uint32_t max_batch = 1, uint32_t max_delay_us = 0);
+
+struct vl_daemon_record {
+    vl_daemon_topic topic;
+    union {
+        // all topics but MAINBOARD
+        vl_event event;
+        // without a device time
+        vl_mainboard_event mainboard;
+    };
+};
+
+static_assert(std::is_trivially_copyable<vl_daemon_record>::value, "records are sent as they are");
+
+struct vl_daemon_batch_header {
+    uint32_t magic;
+    uint32_t count;
+    // records lost since the last batch, as the client was too slow
+    uint32_t dropped;
+    uint32_t reserved;
+};
+
+const char* vl_daemon_topic_name(vl_daemon_topic topic);
+
+// Broadcasting side
+//
+// publish() is called from the capture callbacks and only takes the
+// lock to add to the batches. Connections, subscriptions and batch
+// deadlines are handled on a thread of its own.
+class vl_daemon_server {
+    struct client {
+        int fd;
+        pid_t pid;
+        vl_daemon_subscription subscription;
+        std::vector<vl_daemon_record> batch;
+        std::chrono::steady_clock::time_point deadline;
+        uint32_t dropped;
+        bool closed;
+    };
+
+    int listen_fd = -1;
+    // tells the thread to stop, or that a batch was started
+    int wake_fd = -1;
+    bool stopping = false;
+    std::thread thread;
+    std::mutex mutex;
+    std::vector<client> clients;
+
+    void run();
+    void accept_client();
+    void read_subscription(client& c);
+    void push(client& c, const vl_daemon_record& record);
+    void broadcast(const vl_daemon_record& record);
+    void flush(client& c);
+    void wake();
+
+public:
+    vl_daemon_server() = default;
+    ~vl_daemon_server();
+    vl_daemon_server(const vl_daemon_server&) = delete;
+    vl_daemon_server& operator=(const vl_daemon_server&) = delete;
+
+    bool start(const std::string& name = VL_DAEMON_SOCKET_NAME);
+
+    void publish(const vl_event& event);
+    void publish(const vl_mainboard_event& event);
+};
+
+typedef std::function<void(const vl_daemon_record&)> vl_daemon_sink;
+
+// Attaching side
+class vl_daemon_client {
+    int fd = -1;
+    std::vector<uint8_t> buffer;
+
+public:
+    vl_daemon_client() = default;
+    ~vl_daemon_client();
+    vl_daemon_client(const vl_daemon_client&) = delete;
+    vl_daemon_client& operator=(const vl_daemon_client&) = delete;
+
+    bool connect(const vl_daemon_subscription& subscription,
+                 const std::string& name = VL_DAEMON_SOCKET_NAME);
+    bool subscribe(const vl_daemon_subscription& subscription);
+    // Wait for the next batch and pass on its records. Returns false
+    // once the daemon is gone.
+    bool receive(const vl_daemon_sink& sink, uint32_t* dropped = nullptr);
+};
@@ -0,0 +1,507 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Eigen/Core>
+#include <json/json.h>
+
+#include "vl_cache.h"
+#include "vl_distortion.h"
+#include "vl_log.h"
+
+#define LUT_MAGIC "VLDL"
+
+struct lut_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t size;
+    uint32_t eyes;
+    uint32_t channels;
+    uint32_t reserved[3];
+} __attribute__((packed));
+
+static_assert(sizeof(lut_header) == 32, "the planes start 32 byte aligned");
+
+// Samples closer than this share a lattice line.
+#define LATTICE_TOLERANCE 1e-4f
+
+static const char* channel_keys[VL_DISTORTION_CHANNELS] = {
+    "red_point_samples", "green_point_samples", "blue_point_samples"
+};
+
+bool vl_distortion_parse_meshdata(const std::string& json, vl_distortion_samples* samples) {
+    Json::Value root;
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    std::string errors;
+
+    if (!reader->parse(json.data(), json.data() + json.size(), &root, &errors)) {
+        vl_error("Could not parse the mesh data: %s", errors.c_str());
+        return false;
+    }
+
+    const Json::Value& distortion = root["display"]["hmd"]["distortion"];
+    for (int channel = 0; channel < VL_DISTORTION_CHANNELS; channel++) {
+        const Json::Value& eyes = distortion[channel_keys[channel]];
+        if (!eyes.isArray() || eyes.size() != VL_DISTORTION_EYES) {
+            vl_error("No %s for both eyes in the mesh data.", channel_keys[channel]);
+            return false;
+        }
+
+        for (int eye = 0; eye < VL_DISTORTION_EYES; eye++) {
+            std::vector<vl_distortion_sample>& out = (*samples)[eye][channel];
+            out.clear();
+            out.reserve(eyes[eye].size());
+            for (const Json::Value& sample : eyes[eye]) {
+                // [[x, y], [u, v]]
+                if (sample.size() != 2 || sample[0].size() != 2 || sample[1].size() != 2) {
+                    vl_error("Malformed sample in %s.", channel_keys[channel]);
+                    return false;
+                }
+                out.push_back({ sample[0][0].asFloat(), sample[0][1].asFloat(),
+                                sample[1][0].asFloat(), sample[1][1].asFloat() });
+            }
+        }
+    }
+
+    return true;
+}
+
+bool vl_distortion_save_meshdata(const vl_distortion_samples& samples, const std::string& path) {
+    Json::Value distortion;
+    for (int channel = 0; channel < VL_DISTORTION_CHANNELS; channel++) {
+        Json::Value& eyes = distortion[channel_keys[channel]];
+        eyes = Json::Value(Json::arrayValue);
+        for (int eye = 0; eye < VL_DISTORTION_EYES; eye++) {
+            Json::Value& out = eyes.append(Json::Value(Json::arrayValue));
+            for (const vl_distortion_sample& s : samples[eye][channel]) {
+                Json::Value sample(Json::arrayValue);
+                Json::Value& from = sample.append(Json::Value(Json::arrayValue));
+                from.append(s.x);
+                from.append(s.y);
+                Json::Value& to = sample.append(Json::Value(Json::arrayValue));
+                to.append(s.u);
+                to.append(s.v);
+                out.append(sample);
+            }
+        }
+    }
+
+    Json::Value root;
+    root["display"]["hmd"]["distortion"] = distortion;
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+
+    // Write a new file and move it in place, OSVR may be reading it.
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path);
+    file << Json::writeString(builder, root);
+    file.close();
+
+    if (!file.good() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        vl_warn("Failed to write mesh data %s.", path.c_str());
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void vl_distortion_generate(const vl_distortion_model& model, vl_distortion_samples* samples, uint32_t size) {
+    for (int eye = 0; eye < VL_DISTORTION_EYES; eye++) {
+        const vl_distortion_eye_model& eye_model = model[eye];
+        const float shrink = 1.0f / (1.0f + eye_model.grow);
+
+        for (int channel = 0; channel < VL_DISTORTION_CHANNELS; channel++) {
+            const vl_distortion_coefficients& c = eye_model.channels[channel];
+            std::vector<vl_distortion_sample>& out = (*samples)[eye][channel];
+            out.clear();
+            out.reserve(size * size);
+
+            for (uint32_t j = 0; j < size; j++) {
+                for (uint32_t i = 0; i < size; i++) {
+                    float x = (float) i / (size - 1);
+                    float y = (float) j / (size - 1);
+                    // viewport to normalized device coordinates
+                    float dx = 2 * x - 1 - c.center_x;
+                    float dy = 2 * y - 1 - c.center_y;
+                    float r2 = std::min(dx * dx + dy * dy, eye_model.r2_cutoff);
+                    float scale = 1.0f / (1.0f + r2 * (c.k[0] + r2 * (c.k[1] + r2 * c.k[2])));
+                    float u = (c.center_x + dx * scale) * shrink;
+                    float v = (c.center_y + dy * scale) * shrink;
+                    out.push_back({ x, y, (u + 1) / 2, (v + 1) / 2 });
+                }
+            }
+        }
+    }
+}
+
+static std::vector<float> lattice_lines(const std::vector<vl_distortion_sample>& samples, bool use_y) {
+    std::vector<float> lines;
+    for (const vl_distortion_sample& s : samples)
+        lines.push_back(use_y ? s.y : s.x);
+    std::sort(lines.begin(), lines.end());
+    lines.erase(std::unique(lines.begin(), lines.end(), [](float a, float b) {
+        return b - a < LATTICE_TOLERANCE;
+    }), lines.end());
+    return lines;
+}
+
+static int lattice_index(const std::vector<float>& lines, float value) {
+    auto it = std::lower_bound(lines.begin(), lines.end(), value - LATTICE_TOLERANCE);
+    return it - lines.begin();
+}
+
+// Lattice cell and weight of a value between the first and last line.
+static void lattice_cell(const std::vector<float>& lines, float value, int* i, float* t) {
+    auto it = std::upper_bound(lines.begin(), lines.end(), value);
+    int upper = std::min<int>(std::max<int>(it - lines.begin(), 1), lines.size() - 1);
+    *i = upper - 1;
+    *t = std::min(1.0f, std::max(0.0f, (value - lines[*i]) / (lines[upper] - lines[*i])));
+}
+
+// One channel of one eye into two size x size planes.
+static bool resample(const std::vector<vl_distortion_sample>& samples, uint32_t size, float* u_plane, float* v_plane) {
+    std::vector<float> xs = lattice_lines(samples, false);
+    std::vector<float> ys = lattice_lines(samples, true);
+    size_t w = xs.size(), h = ys.size();
+    if (w < 2 || h < 2 || w * h > 16 * samples.size()) {
+        vl_error("The %zu distortion samples are not on a lattice.", samples.size());
+        return false;
+    }
+
+    std::vector<float> u(w * h), v(w * h);
+    std::vector<bool> known(w * h, false);
+    for (const vl_distortion_sample& s : samples) {
+        size_t k = lattice_index(ys, s.y) * w + lattice_index(xs, s.x);
+        u[k] = s.u;
+        v[k] = s.v;
+        known[k] = true;
+    }
+
+    // Fill the holes from the known 4-neighbours, growing inwards.
+    size_t missing = std::count(known.begin(), known.end(), false);
+    while (missing > 0) {
+        std::vector<bool> filled = known;
+        for (size_t j = 0; j < h; j++) {
+            for (size_t i = 0; i < w; i++) {
+                size_t k = j * w + i;
+                if (known[k])
+                    continue;
+                float su = 0, sv = 0;
+                int n = 0;
+                const long neighbours[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+                for (const auto& d : neighbours) {
+                    long ni = (long) i + d[0], nj = (long) j + d[1];
+                    if (ni < 0 || nj < 0 || ni >= (long) w || nj >= (long) h || !known[nj * w + ni])
+                        continue;
+                    su += u[nj * w + ni];
+                    sv += v[nj * w + ni];
+                    n++;
+                }
+                if (n == 0)
+                    continue;
+                u[k] = su / n;
+                v[k] = sv / n;
+                filled[k] = true;
+                missing--;
+            }
+        }
+        known = std::move(filled);
+    }
+
+    // bilinear on the lattice, which may be irregular
+    for (uint32_t j = 0; j < size; j++) {
+        int cj;
+        float tj;
+        lattice_cell(ys, ys.front() + (ys.back() - ys.front()) * j / (size - 1), &cj, &tj);
+        for (uint32_t i = 0; i < size; i++) {
+            int ci;
+            float ti;
+            lattice_cell(xs, xs.front() + (xs.back() - xs.front()) * i / (size - 1), &ci, &ti);
+            size_t k00 = cj * w + ci, k01 = k00 + 1, k10 = k00 + w, k11 = k10 + 1;
+            u_plane[j * size + i] = (1 - tj) * ((1 - ti) * u[k00] + ti * u[k01]) + tj * ((1 - ti) * u[k10] + ti * u[k11]);
+            v_plane[j * size + i] = (1 - tj) * ((1 - ti) * v[k00] + ti * v[k01]) + tj * ((1 - ti) * v[k10] + ti * v[k11]);
+        }
+    }
+
+    return true;
+}
+
+vl_distortion_lut::~vl_distortion_lut() {
+    release();
+}
+
+void vl_distortion_lut::release() {
+    if (mapping)
+        munmap(mapping, mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+    data.clear();
+    grid = nullptr;
+    size = 0;
+}
+
+bool vl_distortion_lut::build(const vl_distortion_samples& samples, uint32_t grid_size) {
+    if (grid_size < 2 || grid_size > VL_DISTORTION_LUT_MAX_SIZE)
+        return false;
+
+    release();
+    std::vector<float> planes(VL_DISTORTION_EYES * VL_DISTORTION_CHANNELS * 2 * grid_size * grid_size);
+    for (int eye = 0; eye < VL_DISTORTION_EYES; eye++) {
+        for (int channel = 0; channel < VL_DISTORTION_CHANNELS; channel++) {
+            float* u = planes.data() + ((eye * VL_DISTORTION_CHANNELS + channel) * 2) * grid_size * grid_size;
+            if (!resample(samples[eye][channel], grid_size, u, u + grid_size * grid_size))
+                return false;
+        }
+    }
+
+    data = std::move(planes);
+    grid = data.data();
+    size = grid_size;
+    return true;
+}
+
+bool vl_distortion_lut::save(const std::string& path) const {
+    if (empty())
+        return false;
+
+    lut_header header = {};
+    memcpy(header.magic, LUT_MAGIC, 4);
+    header.version = VL_DISTORTION_LUT_VERSION;
+    header.size = size;
+    header.eyes = VL_DISTORTION_EYES;
+    header.channels = VL_DISTORTION_CHANNELS;
+
+    size_t floats = VL_DISTORTION_EYES * VL_DISTORTION_CHANNELS * 2 * size * size;
+
+    // Write a new file and move it in place, a mapping of the old one
+    // stays valid.
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary);
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) grid, floats * sizeof(float));
+    file.close();
+
+    if (!file.good() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        vl_warn("Failed to write distortion table %s.", path.c_str());
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool vl_distortion_lut::load(const std::string& path) {
+    release();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(lut_header)) {
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const lut_header* header = static_cast<const lut_header*>(map);
+    // bounded first, the product must not wrap on 32 bit
+    bool sane = header->size >= 2 && header->size <= VL_DISTORTION_LUT_MAX_SIZE;
+    size_t floats = sane ? VL_DISTORTION_EYES * VL_DISTORTION_CHANNELS * 2 * (size_t) header->size * header->size : 0;
+    if (memcmp(header->magic, LUT_MAGIC, 4) != 0 || header->version != VL_DISTORTION_LUT_VERSION ||
+            header->eyes != VL_DISTORTION_EYES || header->channels != VL_DISTORTION_CHANNELS ||
+            !sane || (size_t) st.st_size != sizeof(lut_header) + floats * sizeof(float)) {
+        vl_warn("Ignoring distortion table %s of another version.", path.c_str());
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    mapping = map;
+    mapping_size = st.st_size;
+    grid = reinterpret_cast<const float*>(static_cast<const char*>(map) + sizeof(lut_header));
+    size = header->size;
+    return true;
+}
+
+void vl_distortion_lut::lookup(int eye, int channel, float x, float y, float* u, float* v) const {
+    float scale = size - 1;
+    float fx = std::min(std::max(x, 0.0f), 1.0f) * scale;
+    float fy = std::min(std::max(y, 0.0f), 1.0f) * scale;
+    int ix = std::min<int>(fx, size - 2);
+    int iy = std::min<int>(fy, size - 2);
+    float tx = fx - ix, ty = fy - iy;
+
+    size_t k = iy * size + ix;
+    const float* pu = plane(eye, channel, 0);
+    const float* pv = plane(eye, channel, 1);
+    *u = (1 - ty) * ((1 - tx) * pu[k] + tx * pu[k + 1]) + ty * ((1 - tx) * pu[k + size] + tx * pu[k + size + 1]);
+    *v = (1 - ty) * ((1 - tx) * pv[k] + tx * pv[k + 1]) + ty * ((1 - tx) * pv[k + size] + tx * pv[k + size + 1]);
+}
+
+// The corners are gathered one by one, the interpolation runs on whole
+// blocks.
+void vl_distortion_lut::evaluate(int eye, int channel, const float* x, const float* y, size_t n, float* u, float* v) const {
+    typedef Eigen::Array<float, VL_DISTORTION_BLOCK, 1> block;
+    typedef Eigen::Array<int, VL_DISTORTION_BLOCK, 1> index_block;
+
+    const float* pu = plane(eye, channel, 0);
+    const float* pv = plane(eye, channel, 1);
+    const float scale = size - 1;
+
+    size_t i = 0;
+    for (; i + VL_DISTORTION_BLOCK <= n; i += VL_DISTORTION_BLOCK) {
+        block fx = Eigen::Map<const block>(x + i).max(0.0f).min(1.0f) * scale;
+        block fy = Eigen::Map<const block>(y + i).max(0.0f).min(1.0f) * scale;
+        index_block ix = fx.cast<int>().min(size - 2);
+        index_block iy = fy.cast<int>().min(size - 2);
+        block tx = fx - ix.cast<float>();
+        block ty = fy - iy.cast<float>();
+        index_block k = iy * size + ix;
+
+        block u00, u01, u10, u11, v00, v01, v10, v11;
+        for (int l = 0; l < VL_DISTORTION_BLOCK; l++) {
+            const float* cu = pu + k[l];
+            const float* cv = pv + k[l];
+            u00[l] = cu[0];
+            u01[l] = cu[1];
+            u10[l] = cu[size];
+            u11[l] = cu[size + 1];
+            v00[l] = cv[0];
+            v01[l] = cv[1];
+            v10[l] = cv[size];
+            v11[l] = cv[size + 1];
+        }
+
+        Eigen::Map<block>(u + i) = (1 - ty) * ((1 - tx) * u00 + tx * u01) + ty * ((1 - tx) * u10 + tx * u11);
+        Eigen::Map<block>(v + i) = (1 - ty) * ((1 - tx) * v00 + tx * v01) + ty * ((1 - tx) * v10 + tx * v11);
+    }
+
+    for (; i < n; i++)
+        lookup(eye, channel, x[i], y[i], u + i, v + i);
+}
+
+vl_distortion_mesh::vl_distortion_mesh(const std::string& serial, std::function<bool(vl_distortion_model*)> read_model)
+    : serial(serial), read_model(std::move(read_model)) {
+    thread = std::thread(&vl_distortion_mesh::run, this);
+}
+
+vl_distortion_mesh::~vl_distortion_mesh() {
+    thread.join();
+}
+
+static bool is_own(const struct stat& st) {
+    return st.st_uid == geteuid();
+}
+
+static void link_file(const std::string& link_path, const std::string& target) {
+    // Only ever replace a link of this user, a file of someone else
+    // would be served instead of the mesh.
+    struct stat st;
+    if (lstat(link_path.c_str(), &st) == 0 && !is_own(st)) {
+        vl_error("%s belongs to another user, not linking the distortion mesh.", link_path.c_str());
+        return;
+    }
+
+    std::string tmp_path = link_path + ".tmp";
+    remove(tmp_path.c_str());
+    if (symlink(target.c_str(), tmp_path.c_str()) != 0 ||
+            rename(tmp_path.c_str(), link_path.c_str()) != 0) {
+        vl_warn("Failed to link %s to %s.", link_path.c_str(), target.c_str());
+        remove(tmp_path.c_str());
+    }
+}
+
+// Point meshdata.json and the runtime link at the file of this headset.
+static void link_meshdata(const std::string& file_name, const std::string& path) {
+    link_file(vl_cache_path("meshdata.json"), file_name);
+
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir || runtime_dir[0] != '/') {
+        vl_warn("No XDG_RUNTIME_DIR, the mesh is only linked from the cache directory.");
+        return;
+    }
+
+    struct stat st;
+    if (stat(runtime_dir, &st) != 0 || !is_own(st) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        vl_error("XDG_RUNTIME_DIR %s is not a private directory of this user, not linking the distortion mesh.", runtime_dir);
+        return;
+    }
+
+    link_file(std::string(runtime_dir) + "/" + VL_DISTORTION_MESHDATA_LINK, path);
+}
+
+void vl_distortion_mesh::run() {
+    const std::string name = vl_cache_serial(serial);
+    const std::string json_name = "meshdata-" + name + ".json";
+    const std::string json_path = vl_cache_path(json_name);
+    const std::string lut_path = vl_cache_path("distortion-" + name + ".bin");
+    if (json_path.empty()) {
+        done = true;
+        return;
+    }
+
+    if (lut.load(lut_path) && access(json_path.c_str(), R_OK) == 0) {
+        vl_debug("Using the cached distortion of %s.", serial.c_str());
+        meshdata_path = json_path;
+        link_meshdata(json_name, json_path);
+        done = true;
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    vl_distortion_model model;
+    if (!read_model(&model)) {
+        vl_warn("No distortion in the config of %s.", serial.c_str());
+        done = true;
+        return;
+    }
+
+    vl_distortion_samples samples;
+    vl_distortion_generate(model, &samples);
+    if (lut.build(samples) && vl_distortion_save_meshdata(samples, json_path)) {
+        lut.save(lut_path);
+        meshdata_path = json_path;
+        link_meshdata(json_name, json_path);
+        vl_info("Generated the distortion of %s in %.1f ms.", serial.c_str(),
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    done = true;
+}
@@ -0,0 +1,161 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VL_DISTORTION_EYES 2
+// red, green, blue
+#define VL_DISTORTION_CHANNELS 3
+
+// Nodes per side of the lookup grid.
+#define VL_DISTORTION_LUT_SIZE 64
+// Larger tables are not loaded, the size comes from the file.
+#define VL_DISTORTION_LUT_MAX_SIZE 4096
+#define VL_DISTORTION_LUT_VERSION 1
+
+// Lattice lines per side of a generated mesh.
+#define VL_DISTORTION_MESH_SIZE 33
+
+// Where a point of the eye's viewport is drawn from, both in [0,1]^2
+// viewport coordinates, for one colour channel.
+struct vl_distortion_sample {
+    float x;
+    float y;
+    float u;
+    float v;
+};
+
+typedef std::array<std::array<std::vector<vl_distortion_sample>, VL_DISTORTION_CHANNELS>,
+                   VL_DISTORTION_EYES> vl_distortion_samples;
+
+// DISTORT_DPOLY3 lens model of one colour channel, as in the
+// tracking_to_eye_transform of the headset config. The center is in
+// normalized device coordinates of the eye's viewport, [-1,1]^2.
+struct vl_distortion_coefficients {
+    float center_x = 0;
+    float center_y = 0;
+    std::array<float, 3> k = {};
+};
+
+struct vl_distortion_eye_model {
+    std::array<vl_distortion_coefficients, VL_DISTORTION_CHANNELS> channels;
+    // The source image overfills the viewport by this factor.
+    float grow = 0;
+    // The polynomial has a pole further out, r^2 is clamped to this.
+    float r2_cutoff = std::numeric_limits<float>::infinity();
+};
+
+typedef std::array<vl_distortion_eye_model, VL_DISTORTION_EYES> vl_distortion_model;
+
+// Sample the model on a regular size x size lattice of the viewport.
+//
+// A viewport point p, relative to the center c, is drawn from
+// c + (p - c) / (1 + k0 r^2 + k1 r^4 + k2 r^6), shrunk by 1 + grow.
+void vl_distortion_generate(const vl_distortion_model& model, vl_distortion_samples* samples,
+                            uint32_t size = VL_DISTORTION_MESH_SIZE);
+
+// Read the red/green/blue_point_samples of an OSVR meshdata file, like
+// HTC_Vive_meshdata.json.
+bool vl_distortion_parse_meshdata(const std::string& json, vl_distortion_samples* samples);
+
+// Write the samples as an OSVR meshdata file, for the
+// rgb_point_samples_external_file of the server config.
+bool vl_distortion_save_meshdata(const vl_distortion_samples& samples, const std::string& path);
+
+// Dense distortion grid per eye and colour channel
+//
+// The point samples lie on a coarse lattice with holes. The holes are
+// filled from their neighbours, then the lattice is resampled to a
+// size x size grid, so a lookup is a plain bilinear interpolation. The
+// file is a 32 byte header and the float planes, which load() maps as
+// they are, without parsing.
+class vl_distortion_lut {
+    uint32_t size = 0;
+    const float* grid = nullptr; // into data or the mapping
+    std::vector<float> data;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+
+    void release();
+    const float* plane(int eye, int channel, int component) const {
+        return grid + ((eye * VL_DISTORTION_CHANNELS + channel) * 2 + component) * size * size;
+    }
+
+public:
+    vl_distortion_lut() = default;
+    ~vl_distortion_lut();
+    vl_distortion_lut(const vl_distortion_lut&) = delete;
+    vl_distortion_lut& operator=(const vl_distortion_lut&) = delete;
+
+    bool build(const vl_distortion_samples& samples, uint32_t size = VL_DISTORTION_LUT_SIZE);
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    bool empty() const { return grid == nullptr; }
+    uint32_t get_size() const { return size; }
+
+    // (x, y) in [0,1]^2, clamped
+    void lookup(int eye, int channel, float x, float y, float* u, float* v) const;
+    // n lookups, vectorized in blocks of VL_DISTORTION_BLOCK
+    void evaluate(int eye, int channel, const float* x, const float* y, size_t n, float* u, float* v) const;
+};
+
+#define VL_DISTORTION_BLOCK 8
+
+// OSVR does not expand ~ or variables in the server config, so the mesh
+// of the last headset is linked here as well, in $XDG_RUNTIME_DIR,
+// /run/user/<uid>. See the sample config.
+#define VL_DISTORTION_MESHDATA_LINK "vive-libre-meshdata.json"
+
+// Distortion of one headset, generated from its config on its own thread
+//
+// Cached as meshdata-<serial>.json for OSVR and distortion-<serial>.bin
+// for lookups, a known headset only maps the table. meshdata.json and
+// VL_DISTORTION_MESHDATA_LINK link to the file of the last headset once
+// it is ready, for a server config that does not know the serial.
+// read_model runs on the thread and is only called without a cached
+// table.
+class vl_distortion_mesh {
+    std::string serial;
+    std::function<bool(vl_distortion_model*)> read_model;
+    vl_distortion_lut lut;
+    std::string meshdata_path;
+    std::atomic<bool> done { false };
+    std::thread thread;
+
+    void run();
+
+public:
+    vl_distortion_mesh(const std::string& serial, std::function<bool(vl_distortion_model*)> read_model);
+    ~vl_distortion_mesh();
+
+    bool ready() const { return done; }
+    // Only once ready(), empty if there was no model.
+    const vl_distortion_lut& get_lut() const { return lut; }
+    const std::string& get_meshdata_path() const { return meshdata_path; }
+};
@@ -24,15 +24,18 @@
  * Boston, MA 02110-1335, USA.
  */
 
+#include <chrono>
 #include <vector>
 #include <map>
 
 #include <libusb.h>
 
+#include "vl_config.h"
 #include "vl_driver.h"
 #include "vl_enums.h"
 #include "vl_math.h"
 #include "vl_log.h"
+#include "vl_watchman.h"
 #include "vl_enums.h"
 
 vl_driver::vl_driver() {
@@ -41,6 +44,13 @@ vl_driver::vl_driver() {
 }
 
 vl_driver::~vl_driver() {
+    // saves once more, before the fusion goes away
+    fusion_checkpoint.reset();
+    // waits for its transfers
+    haptics.reset();
+    // may still be reading the config
+    distortion.reset();
+
     libusb_close(hmd_device.handle);
     libusb_close(hmd_lighthouse_device.handle);
     for (vl_device& device : watchman_dongle_device)
@@ -132,6 +142,10 @@ static bool open_device_idx(libusb_device** devs, vl_device& device, vl_vendor v
 
         print_device_info(handle, desc);
 
+        uint8_t serial[128];
+        if (libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial)) >= 0)
+            device.serial = (const char*) serial;
+
         uint8_t nb_interfaces = conf_desc->bNumInterfaces;
         std::vector<int> interfaces = {};
         vl_debug("nb_interfaces: %d", nb_interfaces);
@@ -221,15 +235,34 @@ bool vl_driver::open_devices(int idx)
 
     libusb_free_device_list(devs, 1);
 
+    haptics = std::make_unique<vl_haptics>(context, std::array<libusb_device_handle*, VL_HAPTICS_CONTROLLERS> {
+        watchman_dongle_device[0].handle, watchman_dongle_device[1].handle
+    });
+
     //hret = hid_send_feature_report(drv->hmd_device, vive_magic_enable_lighthouse, sizeof(vive_magic_enable_lighthouse));
     //vl_debug("enable lighthouse magic: %d\n", hret);
 
     sensor_fusion = std::make_unique<vl_fusion>();
 
+    // Resume the learned fusion state of this headset after a restart.
+    if (!hmd_device.serial.empty()) {
+        vl_fusion_state state;
+        if (vl_checkpoint_load(hmd_device.serial, &state)) {
+            sensor_fusion->set_state(state);
+            vl_info("Restored fusion state of %s.", hmd_device.serial.c_str());
+        }
+        fusion_checkpoint = std::make_unique<vl_fusion_checkpoint>(sensor_fusion.get(), hmd_device.serial);
+    }
+
+    // Known rooms start tracking in the common frame as soon as the
+    // base station serials are decoded, without a new room setup.
+    room_setups = vl_room_setup_load();
+    if (!room_setups.empty())
+        vl_info("Loaded %zu cached room setups.", room_setups.size());
+
     return true;
 }
 
-#define VL_GRAVITY_EARTH 9.81
 #define VL_POW_2_M13 4.0/32768.0 // pow(2, -13)
 #define VL_POW_2_M12 8.0/32768.0 // pow(2, -12)
 #define VL_ACCEL_FACTOR VL_GRAVITY_EARTH * VL_POW_2_M13
@@ -246,36 +279,35 @@ static Eigen::Vector3d vec3_from_gyro(const __s16* smp)
     return sample * VL_POW_2_M12; // 8/32768 = 2^-12
 }
 
-void vl_driver_log_watchman(uint8_t* buffer, int size, vl_driver* driver) {
-    (void)driver;
+static unsigned controller_index(vl_driver* driver) {
+    return driver->capture_device == &driver->watchman_dongle_device[1] ? 1 : 0;
+}
+
+static vl_watchman_clock& controller_clock(vl_driver* driver) {
+    return driver->controller_clocks[controller_index(driver)];
+}
 
+void vl_driver_log_watchman(uint8_t* buffer, int size, vl_driver* driver) {
     vl_report_id report_id = static_cast<vl_report_id>(buffer[0]);
 
-    if (report_id == vl_report_id::CONTROLLER1) {
-        vive_controller_report1 pkt;
-        vl_msg_decode_watchman(&pkt, buffer, size);
-        vive_controller_message* msg = &pkt.message;
-        vl_msg_print_watchman(msg);
-
-    } else if (report_id == vl_report_id::CONTROLLER2) {
-        vive_controller_report2 pkt;
-        vl_msg_decode_watchman2(&pkt, buffer, size);
-        for (int i = 0; i < 2; ++i) {
-            vive_controller_message* msg = &pkt.message[i];
-            vl_msg_print_watchman(msg);
-        }
+    if (report_id == vl_report_id::CONTROLLER1 || report_id == vl_report_id::CONTROLLER2) {
+        vl_watchman_clock& clock = controller_clock(driver);
+        vl_watchman_parse_stats stats;
+        if (!vl_watchman_parse(buffer, size, [&clock](const vl_watchman_event& event) {
+                vl_watchman_print_event(event, clock.update(event));
+            }, &stats))
+            vl_debug("Malformed controller report 0x%02x.", buffer[0]);
 
     } else if (report_id == vl_report_id::CONTROLLER_DISCONNECT) {
         vl_info("Controller disconnected.");
+        controller_clock(driver).reset();
 
     } else {
         vl_warn("Called %s with a wrong buffer type (0x%02x).", __func__, buffer[0]);
     }
 }
 
-void vl_driver_log_hmd_mainboard(unsigned char *buffer, int size, vl_driver* driver) {
-    (void)driver;
-
+void vl_driver_update_mainboard(unsigned char *buffer, int size, vl_driver* driver) {
     vl_report_id report_id = static_cast<vl_report_id>(buffer[0]);
 
     if (size != 64) {
@@ -294,38 +326,14 @@ void vl_driver_log_hmd_mainboard(unsigned char *buffer, int size, vl_driver* dri
 
     // TODO: use a proper decode function.
     memcpy(&pkt, buffer, size);
-    //vl_msg_decode_hmd_mainboard(&pkt, buffer, size);
-    //vl_msg_print_hmd_mainboard(&pkt);
-
-    assert(pkt.len == 60);
-
-    switch (pkt.proximity_change) {
-    case NO_CHANGE:
-        break;
-    case DECREASE:
-        vl_info("proximity decreased: %d", pkt.proximity);
-        break;
-    case INCREASE:
-        vl_info("proximity increased: %d", pkt.proximity);
-        break;
-    }
-
-    uint16_t lens_separation = __le16_to_cpu(pkt.lens_separation);
-    if (lens_separation != driver->lens_separation) {
-        vl_info("lens_separation: %d", lens_separation);
-        driver->lens_separation = lens_separation;
-    }
 
-    if (pkt.button != driver->button) {
-        vl_info("button: %d", pkt.button);
-        driver->button = pkt.button;
+    if (pkt.len != 60) {
+        vl_warn("Mainboard status report with a wrong length (%d).", pkt.len);
+        return;
     }
 
-    uint16_t ipd = __le16_to_cpu(pkt.ipd);
-    if (ipd != driver->ipd) {
-        vl_info("IPD: %4.1fmm", 1e-2 * ipd);
-        driver->ipd = ipd;
-    }
+    driver->mainboard.update(pkt, driver->mainboard_sink);
+    driver->scheduler.set_worn(driver->mainboard.is_worn());
 }
 
 void vl_driver_log_hmd_imu(unsigned char *buffer, int size, vl_driver* driver) {
@@ -362,26 +370,36 @@ void vl_driver_log_hmd_light(uint8_t* buffer, int size, vl_driver* driver) {
     }
 }
 
+// Called from the transfer callback, so vl_device::transfers only holds
+// running captures.
+static void vl_driver_actually_stop_capture(vl_device& dev, libusb_transfer* transfer) {
+    dev.transfer_buffers.erase(transfer->endpoint);
+    dev.transfers.erase(transfer->endpoint);
+    libusb_free_transfer(transfer);
+}
+
 static void handle_transfer(libusb_transfer* transfer) {
     vl_callback* callback = reinterpret_cast<vl_callback*>(transfer->user_data);
 
     if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
         vl_debug("Transfer cancelled.");
+        vl_driver_actually_stop_capture(*callback->device, transfer);
         delete callback;
-        libusb_free_transfer(transfer);
         return;
     }
 
     if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
         vl_error("Transfer had an issue: %d", transfer->status);
+        vl_driver_actually_stop_capture(*callback->device, transfer);
         delete callback;
-        libusb_free_transfer(transfer);
         return;
     }
 
     vl_debug("Transfer complete of %d bytes!", transfer->actual_length);
 
+    callback->driver->capture_device = callback->device;
     callback->func(transfer->buffer, transfer->actual_length, callback->driver);
+    callback->driver->capture_device = nullptr;
 
     libusb_error ret = static_cast<libusb_error>(libusb_submit_transfer(transfer));
     if (ret != LIBUSB_SUCCESS) {
@@ -409,6 +427,7 @@ static bool vl_driver_start_capture(vl_driver* driver, vl_device& dev, int endpo
 
     vl_callback* callback = new vl_callback();
     callback->driver = driver;
+    callback->device = &dev;
     callback->func = func;
 
     libusb_fill_interrupt_transfer(transfer, dev.handle, endpoint, buffer, length, handle_transfer, reinterpret_cast<void*>(callback), 0);
@@ -425,18 +444,20 @@ static bool vl_driver_start_capture(vl_driver* driver, vl_device& dev, int endpo
     return true;
 }
 
-// XXX: use that.
-#if 0
-static bool vl_driver_actually_stop_capture(vl_device& dev, int endpoint) {
-    dev.transfer_buffers.erase(endpoint);
-    dev.transfers.erase(endpoint);
+bool vl_driver::is_capturing() const {
+    for (const vl_device* device : { &hmd_device, &hmd_lighthouse_device,
+                                     &watchman_dongle_device[0], &watchman_dongle_device[1] })
+        if (!device->transfers.empty())
+            return true;
+    return false;
 }
-#endif
 
+// Cancelling only requests it, the transfer is gone once this ran.
 static bool vl_driver_stop_capture(vl_device& dev, int endpoint) {
-    libusb_transfer* transfer = dev.transfers[endpoint];
-    libusb_cancel_transfer(transfer);
-    return true;
+    auto transfer = dev.transfers.find(endpoint);
+    if (transfer == dev.transfers.end())
+        return false;
+    return libusb_cancel_transfer(transfer->second) == LIBUSB_SUCCESS;
 }
 
 bool vl_driver_start_hmd_mainboard_capture(vl_driver* driver, capture_callback fun) {
@@ -461,8 +482,10 @@ bool vl_driver_start_watchman_capture(vl_driver* driver, capture_callback fun) {
 }
 
 bool vl_driver_stop_watchman_capture(vl_driver* driver) {
-    return vl_driver_stop_capture(driver->watchman_dongle_device[0], 0x81)
-        && vl_driver_stop_capture(driver->watchman_dongle_device[1], 0x81);
+    // both, even if the first was not running
+    bool first = vl_driver_stop_capture(driver->watchman_dongle_device[0], 0x81);
+    bool second = vl_driver_stop_capture(driver->watchman_dongle_device[1], 0x81);
+    return first && second;
 }
 
 bool vl_driver_start_hmd_light_capture(vl_driver* driver, capture_callback fun) {
@@ -474,6 +497,10 @@ bool vl_driver_stop_hmd_light_capture(vl_driver* driver) {
 }
 
 bool vl_driver::poll() {
+    // pulses held back by the rate limit
+    if (haptics)
+        haptics->dispatch();
+
     libusb_error ret = static_cast<libusb_error>(libusb_handle_events(context));
     if (ret != LIBUSB_SUCCESS) {
         vl_debug("Failed to poll: %s", libusb_strerror(ret));
@@ -502,6 +529,9 @@ void vl_driver::_update_pose(const vive_headset_imu_report &pkt) {
                 pkt.samples[1].seq,
                 pkt.samples[2].seq);
 
+    bool updated = false;
+    Eigen::Vector3d angular_velocity;
+
     for (int offset = 0; offset < 3; offset++) {
         int index = (li + offset) % 3;
 
@@ -516,10 +546,32 @@ void vl_driver::_update_pose(const vive_headset_imu_report &pkt) {
             float dt = FREQ_48MHZ * (sample.time_ticks - previous_ticks);
             Eigen::Vector3d vec3_gyro = vec3_from_gyro(sample.rot);
             Eigen::Vector3d vec3_accel = vec3_from_accel(sample.acc);
-            sensor_fusion->update(dt, vec3_gyro, vec3_accel);
+            scheduler.update(vec3_gyro - sensor_fusion->get_gyro_bias(), vec3_accel,
+                             sensor_fusion->get_stillness().is_still());
+
+            bool correct = scheduler.correction_due();
+            auto start = std::chrono::steady_clock::now();
+            sensor_fusion->update(dt, vec3_gyro, vec3_accel, correct);
+            scheduler.add_update_time(correct, std::chrono::steady_clock::now() - start);
             previous_ticks = pkt.samples[index].time_ticks;
+            angular_velocity = vec3_gyro - sensor_fusion->get_gyro_bias();
+            updated = true;
         }
     }
+
+    // once per report, the samples of a report arrive together
+    if (updated && (pose_export.is_open() || pose_sink)) {
+        uint32_t flags = 0;
+        if (sensor_fusion->is_started())
+            flags |= VL_POSE_SHM_STARTED;
+        if (sensor_fusion->get_stillness().is_still())
+            flags |= VL_POSE_SHM_STILL;
+        vl_pose_shm_sample sample = vl_pose_sample(pose_clock.unwrap(previous_ticks),
+                                                   sensor_fusion->orientation, angular_velocity, flags);
+        pose_export.publish(sample);
+        if (pose_sink)
+            pose_sink(sample);
+    }
 }
 
 void vl_driver_update_pose(uint8_t* buffer, int size, vl_driver* driver) {
@@ -542,3 +594,263 @@ void vl_driver_update_pose(uint8_t* buffer, int size, vl_driver* driver) {
     vl_msg_decode_hmd_imu(&pkt, buffer, size);
     driver->_update_pose(pkt);
 }
+
+void vl_driver::init_event_merge(const vl_event_sink& sink, uint64_t latency_bound, size_t buffer_size) {
+    event_merge = std::make_unique<vl_event_merge>(sink, latency_bound, buffer_size);
+    for (vl_tick_unwrapper& clock : event_clocks)
+        clock.reset();
+    for (vl_watchman_clock& clock : controller_clocks)
+        clock.reset();
+    last_imu_event_time = 0;
+}
+
+static void merge_push(vl_driver* driver, vl_event& event, uint32_t ticks) {
+    event.time = driver->event_clocks[static_cast<size_t>(event.stream)].unwrap(ticks);
+    driver->event_merge->push(event);
+}
+
+void vl_driver_merge_hmd_imu(uint8_t* buffer, int size, vl_driver* driver) {
+    if (!driver->event_merge) {
+        vl_warn("Called %s without an event merge, see init_event_merge().", __func__);
+        return;
+    }
+
+    vive_headset_imu_report pkt;
+    if (buffer[0] != static_cast<uint8_t>(vl_report_id::HMD_IMU) ||
+            !vl_msg_decode_hmd_imu(&pkt, buffer, size)) {
+        vl_warn("Called %s with a wrong buffer type (0x%02x).", __func__, buffer[0]);
+        return;
+    }
+
+    int li = get_lowest_index(
+                pkt.samples[0].seq,
+                pkt.samples[1].seq,
+                pkt.samples[2].seq);
+
+    vl_tick_unwrapper& clock = driver->event_clocks[static_cast<size_t>(vl_event_stream::HMD_IMU)];
+
+    // Each report repeats the previous samples, only push the new ones.
+    for (int offset = 0; offset < 3; offset++) {
+        const vive_headset_imu_sample& sample = pkt.samples[(li + offset) % 3];
+
+        uint64_t time = clock.unwrap(sample.time_ticks);
+        if (driver->last_imu_event_time != 0 && time <= driver->last_imu_event_time)
+            continue;
+        driver->last_imu_event_time = time;
+
+        vl_event event = {};
+        event.stream = vl_event_stream::HMD_IMU;
+        event.time = time;
+        event.imu = sample;
+        driver->event_merge->push(event);
+    }
+}
+
+void vl_driver_merge_hmd_light(uint8_t* buffer, int size, vl_driver* driver) {
+    if (!driver->event_merge) {
+        vl_warn("Called %s without an event merge, see init_event_merge().", __func__);
+        return;
+    }
+
+    vive_headset_lighthouse_pulse_report2 pkt;
+    if (buffer[0] != static_cast<uint8_t>(vl_report_id::HMD_LIGHTHOUSE_PULSE2) ||
+            !vl_msg_decode_hmd_light(&pkt, buffer, size)) {
+        vl_warn("Called %s with a wrong buffer type (0x%02x).", __func__, buffer[0]);
+        return;
+    }
+
+    for (int i = 0; i < 9; i++) {
+        if (!is_sample_valid(pkt.samples[i]))
+            continue;
+
+        vl_event event = {};
+        event.stream = vl_event_stream::HMD_LIGHT;
+        event.light = pkt.samples[i];
+        merge_push(driver, event, pkt.samples[i].timestamp);
+    }
+}
+
+void vl_driver_merge_watchman(uint8_t* buffer, int size, vl_driver* driver) {
+    if (!driver->event_merge) {
+        vl_warn("Called %s without an event merge, see init_event_merge().", __func__);
+        return;
+    }
+
+    vl_event_stream stream = driver->capture_device == &driver->watchman_dongle_device[1]
+            ? vl_event_stream::WATCHMAN2
+            : vl_event_stream::WATCHMAN1;
+
+    vl_report_id report_id = static_cast<vl_report_id>(buffer[0]);
+
+    if (report_id == vl_report_id::CONTROLLER1 || report_id == vl_report_id::CONTROLLER2) {
+        vl_watchman_clock& clock = controller_clock(driver);
+        vl_watchman_parse_stats stats;
+        vl_watchman_parse(buffer, size, [driver, stream, &clock](const vl_watchman_event& controller) {
+            vl_event event = {};
+            event.stream = stream;
+            event.time = clock.update(controller);
+            event.controller = controller;
+            driver->event_merge->push(event);
+        }, &stats);
+    } else if (report_id == vl_report_id::CONTROLLER_DISCONNECT) {
+        controller_clock(driver).reset();
+    } else {
+        vl_warn("Called %s with a wrong buffer type (0x%02x).", __func__, buffer[0]);
+    }
+}
+
+void vl_driver_update_controller(uint8_t* buffer, int size, vl_driver* driver) {
+    unsigned index = controller_index(driver);
+    vl_watchman_clock& clock = driver->controller_clocks[index];
+
+    vl_report_id report_id = static_cast<vl_report_id>(buffer[0]);
+
+    if (report_id == vl_report_id::CONTROLLER1 || report_id == vl_report_id::CONTROLLER2) {
+        vl_watchman_parse_stats stats;
+        vl_watchman_parse(buffer, size, [driver, index, &clock](const vl_watchman_event& event) {
+            driver->input.update(index, event, clock.update(event), &driver->input_events);
+        }, &stats);
+    } else if (report_id == vl_report_id::CONTROLLER_DISCONNECT) {
+        driver->input.reset(index, clock.get_last(), &driver->input_events);
+        clock.reset();
+    } else {
+        vl_warn("Called %s with a wrong buffer type (0x%02x).", __func__, buffer[0]);
+    }
+}
+
+std::string vl_driver::read_config() {
+    // Concurrent downloads would interleave their feature reports.
+    std::lock_guard<std::mutex> lock(config_mutex);
+    if (config.empty()) {
+        char* data = vl_get_config(hmd_lighthouse_device, 0);
+        if (data)
+            config = data;
+        free(data);
+    }
+    return config;
+}
+
+bool vl_driver::init_distortion() {
+    if (hmd_device.serial.empty()) {
+        vl_warn("No headset serial to cache the distortion for.");
+        return false;
+    }
+
+    distortion = std::make_unique<vl_distortion_mesh>(hmd_device.serial, [this](vl_distortion_model* model) {
+        return vl_config_distortion(read_config().c_str(), model);
+    });
+
+    return true;
+}
+
+bool vl_driver::init_pose_export(const std::string& name) {
+    pose_clock.reset();
+    return pose_export.open(name);
+}
+
+// The room setup of the stations in view, once both serials are known.
+static void find_room_setup(vl_driver* driver) {
+    const vl_ootx_decoders& ootx = driver->heading_light.ootx;
+    auto b = ootx.find('B');
+    auto c = ootx.find('C');
+    if (b == ootx.end() || !b->second.has_info || c == ootx.end() || !c->second.has_info)
+        return;
+
+    driver->room_setup = vl_room_setup_find(driver->room_setups, b->second.info.id, c->second.info.id);
+    if (!driver->room_setup)
+        return;
+
+    vl_info("Heading uses the room setup of stations 0x%08x and 0x%08x.",
+            b->second.info.id, c->second.info.id);
+    // the reference was taken in the frame of a single station
+    driver->heading->reset();
+}
+
+// Frames come from the classifier as soon as a station finished its
+// cycle. Without a room setup, the tracker is calibrated to a single
+// station, the first one in view, so a single station in mode A works
+// as well as B+C. With one, frames of both stations are used.
+static void correct_heading(vl_driver* driver, char station, const vl_light_frame& frame) {
+    if (__builtin_popcount(frame.visible) < 3)
+        return;
+
+    if (!driver->room_setup && !driver->room_setups.empty())
+        find_room_setup(driver);
+
+    Eigen::Matrix3d station_from_room = Eigen::Matrix3d::Identity();
+    if (driver->room_setup && (station == 'B' || station == 'C')) {
+        const vl_station_pose& pose = station == 'B' ? driver->room_setup->pose_b : driver->room_setup->pose_c;
+        station_from_room = pose.linear().transpose();
+        driver->heading_station = station;
+    } else if (station != driver->heading_station) {
+        if (driver->heading_station && frame.t - driver->heading_station_ticks < VL_HEADING_STATION_TIMEOUT_TICKS)
+            return;
+        if (driver->heading_station)
+            vl_info("Heading follows station %c, %c is out of view.", station, driver->heading_station);
+        driver->heading_station = station;
+        driver->heading->reset();
+    }
+    driver->heading_station_ticks = frame.t;
+
+    // calibration attempts as well, they run P3P
+    if (frame.t - driver->heading_ticks < VL_HEADING_PERIOD_TICKS)
+        return;
+    driver->heading_ticks = frame.t;
+
+    double yaw;
+    if (driver->heading->update(frame, driver->sensor_fusion->orientation, &yaw, station_from_room)) {
+        vl_debug("Heading correction %.3f deg, residual %g", yaw * 180.0 / M_PI, driver->heading->rms);
+        driver->sensor_fusion->correct_yaw(yaw);
+    }
+}
+
+bool vl_driver::init_heading_correction() {
+    vl_model_points model;
+    vl_model_normals normals;
+    bool success = vl_config_sensor_model(read_config().c_str(), &model, &normals);
+
+    if (!success) {
+        vl_error("No sensor positions in the device config, heading correction disabled.");
+        return false;
+    }
+
+    heading = std::make_unique<vl_heading_tracker>(model);
+    heading_light.reset();
+    heading_station = 0;
+    room_setup = nullptr;
+
+    heading_light.frame_sink = [this](char station, const vl_light_frame& frame) {
+        correct_heading(this, station, frame);
+    };
+
+    return true;
+}
+
+void vl_driver_correct_heading(uint8_t* buffer, int size, vl_driver* driver) {
+    if (!driver->heading) {
+        vl_warn("Called %s without a heading tracker, see init_heading_correction().", __func__);
+        return;
+    }
+
+    // Cycles cut by the pause would be stale once processing resumes.
+    if (!driver->scheduler.optical_enabled()) {
+        driver->heading_light.reset();
+        driver->scheduler.skip_optical_report();
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    vive_headset_lighthouse_pulse_report2 pkt;
+    if (buffer[0] != static_cast<uint8_t>(vl_report_id::HMD_LIGHTHOUSE_PULSE2) ||
+            !vl_msg_decode_hmd_light(&pkt, buffer, size)) {
+        vl_warn("Called %s with a wrong buffer type (0x%02x).", __func__, buffer[0]);
+        return;
+    }
+
+    for (int i = 0; i < 9; i++)
+        if (is_sample_valid(pkt.samples[i]))
+            driver->heading_light.push(pkt.samples[i]);
+
+    driver->scheduler.add_optical_time(std::chrono::steady_clock::now() - start);
+}
@@ -29,24 +29,44 @@
 #include <cassert>
 #include <cstdint>
 #include <map>
+#include <mutex>
+#include <string>
 #include <unistd.h>
 #include <vector>
 
 #include <libusb.h>
 
+#include "vl_checkpoint.h"
+#include "vl_distortion.h"
 #include "vl_magic.h"
+#include "vl_event_merge.h"
 #include "vl_fusion.h"
+#include "vl_haptics.h"
+#include "vl_heading.h"
+#include "vl_input.h"
 #include "vl_messages.h"
 #include "vl_light.h"
 #include "vl_log.h"
+#include "vl_mainboard.h"
+#include "vl_pose_export.h"
+#include "vl_room_setup.h"
+#include "vl_scheduler.h"
 
 #define FEATURE_BUFFER_SIZE 64
 
 #define FREQ_48MHZ 1.0f / 48000000.0f
 
+// At most one heading correction per this many ticks of light, 10 Hz.
+// Corrections pause while the device is still, see vl_scheduler.
+#define VL_HEADING_PERIOD_TICKS (48000000 / 10)
+// The heading follows another station once its own one sent no frame
+// for this long.
+#define VL_HEADING_STATION_TIMEOUT_TICKS 48000000
+
 struct vl_device {
     libusb_device_handle* handle = nullptr;
     std::vector<int> interfaces;
+    std::string serial;
     std::map<int, libusb_transfer*> transfers;
     std::map<int, std::array<uint8_t, FEATURE_BUFFER_SIZE>> transfer_buffers;
 };
@@ -54,6 +74,9 @@ struct vl_device {
 class vl_driver {
 private:
     libusb_context* context;
+    // The device config, downloaded once, see read_config().
+    std::mutex config_mutex;
+    std::string config;
 
 public:
     vl_device hmd_device;
@@ -61,10 +84,54 @@ public:
     std::array<vl_device, 2> watchman_dongle_device;
     uint32_t previous_ticks;
     std::unique_ptr<vl_fusion> sensor_fusion;
+    // Processing rates while the headset is still.
+    vl_scheduler scheduler;
     vl_lighthouse_samples raw_light_samples = {};
-    uint16_t lens_separation;
-    uint16_t ipd;
-    bool button;
+    // Headset controls and proximity, see vl_driver_update_mainboard().
+    vl_mainboard_state mainboard;
+    vl_mainboard_sink mainboard_sink;
+
+    // Set while a capture callback runs, to tell apart devices that
+    // share a callback, like the two watchman dongles.
+    const vl_device* capture_device = nullptr;
+
+    std::unique_ptr<vl_event_merge> event_merge;
+    std::array<vl_tick_unwrapper, VL_EVENT_STREAM_COUNT> event_clocks;
+    // Per dongle, see vl_watchman_clock.
+    std::array<vl_watchman_clock, VL_WATCHMAN_CONTROLLERS> controller_clocks;
+
+    // Controller input changes, see vl_driver_update_controller().
+    vl_input_tracker input;
+    vl_input_queue input_events;
+    uint64_t last_imu_event_time = 0;
+
+    std::unique_ptr<vl_fusion_checkpoint> fusion_checkpoint;
+
+    // Fused poses for local readers, see init_pose_export().
+    vl_pose_export pose_export;
+    vl_tick_unwrapper pose_clock;
+    // Every fused IMU report, like the export.
+    vl_pose_sink pose_sink;
+
+    // Controller pulses, sent from poll().
+    std::unique_ptr<vl_haptics> haptics;
+
+    // Cached base station placements, see vl_room_setup_find(). The
+    // heading uses the one of the stations in view, once their serials
+    // are decoded.
+    vl_room_setups room_setups;
+    const vl_room_setup* room_setup = nullptr;
+
+    // Display distortion of the headset, see init_distortion().
+    std::unique_ptr<vl_distortion_mesh> distortion;
+
+    // Optical yaw correction, see init_heading_correction().
+    std::unique_ptr<vl_heading_tracker> heading;
+    vl_light_classifier heading_light;
+    // the station the tracker is calibrated to, 0 before the first frame
+    char heading_station = 0;
+    uint32_t heading_station_ticks = 0;
+    uint32_t heading_ticks = 0;
 
     vl_driver();
     ~vl_driver();
@@ -73,12 +140,26 @@ public:
     void add_fd(int fd, short events);
     void remove_fd(int fd);
     bool poll();
+    // Whether a capture still has a transfer, stopped captures end in
+    // poll().
+    bool is_capturing() const;
     void update_pose();
+    void init_event_merge(const vl_event_sink& sink,
+                          uint64_t latency_bound = VL_EVENT_MERGE_LATENCY,
+                          size_t buffer_size = VL_EVENT_MERGE_BUFFER_SIZE);
+    bool init_heading_correction();
+    bool init_distortion();
+    // Publish every fused IMU report to shared memory, see vl_pose_shm.h.
+    bool init_pose_export(const std::string& name = VL_POSE_SHM_NAME);
+    // The headset config, empty if it could not be read. Safe to call
+    // from any thread.
+    std::string read_config();
 
     void _update_pose(const vive_headset_imu_report &pkt);
 };
 
-static inline int hid_send_feature_report(libusb_device_handle* dev, uint16_t interface, std::vector<uint8_t> data) {
+template <size_t N>
+static inline int hid_send_feature_report(libusb_device_handle* dev, uint16_t interface, const std::array<uint8_t, N>& data) {
     // Currently not implemented and unused, see hidapi’s implementation.
     assert(data[0] != 0);
 
@@ -89,7 +170,8 @@ static inline int hid_send_feature_report(libusb_device_handle* dev, uint16_t in
                                       0x09/*HID set_report*/,
                                       report_id,
                                       interface,
-                                      data.data(), data.size(),
+                                      // only read for an OUT transfer
+                                      const_cast<uint8_t*>(data.data()), data.size(),
                                       1000/*timeout millis*/);
     if (ret < 0)
         return -1;
@@ -100,15 +182,27 @@ static inline int hid_send_feature_report(libusb_device_handle* dev, uint16_t in
 typedef void(*capture_callback)(uint8_t*, int, vl_driver*);
 struct vl_callback {
     vl_driver* driver;
+    vl_device* device;
     capture_callback func;
 };
 
-void vl_driver_log_hmd_mainboard(uint8_t* buffer, int size, vl_driver* driver);
+// Tracks the mainboard state, publishes the changes to mainboard_sink
+// and slows down processing while the headset is not worn.
+void vl_driver_update_mainboard(uint8_t* buffer, int size, vl_driver* driver);
 void vl_driver_log_hmd_imu(uint8_t* buffer, int size, vl_driver* driver);
 void vl_driver_log_watchman(uint8_t* buffer, int size, vl_driver* driver);
 void vl_driver_log_hmd_light(uint8_t* buffer, int size, vl_driver* driver);
 void vl_driver_update_pose(uint8_t* buffer, int size, vl_driver* driver);
 
+void vl_driver_merge_hmd_imu(uint8_t* buffer, int size, vl_driver* driver);
+void vl_driver_merge_hmd_light(uint8_t* buffer, int size, vl_driver* driver);
+void vl_driver_merge_watchman(uint8_t* buffer, int size, vl_driver* driver);
+// Pushes the button, trigger and trackpad changes to input_events. The
+// consumer pops them from one other thread.
+void vl_driver_update_controller(uint8_t* buffer, int size, vl_driver* driver);
+
+void vl_driver_correct_heading(uint8_t* buffer, int size, vl_driver* driver);
+
 bool vl_driver_start_hmd_mainboard_capture(vl_driver*, capture_callback);
 bool vl_driver_stop_hmd_mainboard_capture(vl_driver*);
 bool vl_driver_start_hmd_imu_capture(vl_driver*, capture_callback);
@@ -0,0 +1,147 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "vl_event_merge.h"
+#include "vl_log.h"
+
+vl_event_merge::vl_event_merge(const vl_event_sink& sink, uint64_t latency_bound, size_t buffer_size) {
+    this->sink = sink;
+    this->latency_bound = latency_bound;
+    for (auto& buffer : buffers)
+        buffer = std::make_unique<vl_reorder_buffer<vl_event>>(buffer_size);
+}
+
+// The device clock the stream is on.
+static size_t clock_index(vl_event_stream stream) {
+    switch (stream) {
+    case vl_event_stream::WATCHMAN1:
+        return 1;
+    case vl_event_stream::WATCHMAN2:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t host_ticks_now() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() * 48 / 1000;
+}
+
+uint64_t vl_event_merge::to_host_time(const vl_event& event, uint64_t arrival) {
+    clock& c = clocks[clock_index(event.stream)];
+    int64_t offset = static_cast<int64_t>(arrival - event.time);
+
+    if (!c.valid) {
+        c.valid = true;
+        c.offset = offset;
+    } else {
+        // the lowest latency arrival so far, allowing for drift
+        int64_t elapsed = std::max<int64_t>(static_cast<int64_t>(arrival - c.last_host), 0);
+        int64_t drift = elapsed * VL_EVENT_MERGE_MAX_DRIFT / 1000000;
+        c.offset = std::min(c.offset + drift, offset);
+    }
+    c.last_host = arrival;
+
+    return event.time + c.offset;
+}
+
+int vl_event_merge::oldest_stream() const {
+    int oldest = -1;
+    for (size_t i = 0; i < VL_EVENT_STREAM_COUNT; i++) {
+        if (buffers[i]->empty())
+            continue;
+        if (oldest < 0 || buffers[i]->front_time() < buffers[oldest]->front_time())
+            oldest = i;
+    }
+    return oldest;
+}
+
+void vl_event_merge::emit(int stream) {
+    last_emitted = buffers[stream]->front_time();
+    vl_event event = buffers[stream]->pop();
+    emitted_any = true;
+    stats.emitted++;
+    sink(event);
+}
+
+void vl_event_merge::drain(bool force) {
+    // Gone quiet, like a controller turned off.
+    for (size_t i = 0; i < VL_EVENT_STREAM_COUNT; i++)
+        if (active[i] && buffers[i]->empty() && last_seen[i] + latency_bound <= newest)
+            active[i] = false;
+
+    int stream;
+    while ((stream = oldest_stream()) >= 0) {
+        bool complete = true;
+        for (size_t i = 0; i < VL_EVENT_STREAM_COUNT; i++)
+            if (active[i] && buffers[i]->empty())
+                complete = false;
+
+        bool expired = buffers[stream]->front_time() + latency_bound <= newest;
+
+        if (!complete && !expired && !force)
+            return;
+
+        if (!complete)
+            stats.forced++;
+
+        emit(stream);
+    }
+}
+
+void vl_event_merge::push(const vl_event& event) {
+    push(event, host_ticks_now());
+}
+
+void vl_event_merge::push(const vl_event& event, uint64_t arrival) {
+    size_t stream = static_cast<size_t>(event.stream);
+    assert(stream < VL_EVENT_STREAM_COUNT);
+
+    uint64_t time = to_host_time(event, arrival);
+
+    if (emitted_any && time < last_emitted) {
+        stats.late++;
+        vl_debug("Dropping late event on stream %zu (%lu ticks behind).",
+                 stream, last_emitted - time);
+        return;
+    }
+
+    active[stream] = true;
+    last_seen[stream] = time;
+    if (time > newest)
+        newest = time;
+
+    // Make room, this stream is too far ahead of the others.
+    if (buffers[stream]->full()) {
+        while (buffers[stream]->full())
+            emit(oldest_stream());
+        stats.forced++;
+    }
+
+    buffers[stream]->push(time, event);
+    drain(false);
+}
+
+void vl_event_merge::flush() {
+    drain(true);
+}
@@ -0,0 +1,132 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "vl_hid_reports.h"
+#include "vl_reorder.h"
+#include "vl_watchman.h"
+
+enum class vl_event_stream : uint8_t {
+    HMD_IMU,
+    HMD_LIGHT,
+    WATCHMAN1,
+    WATCHMAN2,
+    COUNT,
+};
+
+#define VL_EVENT_STREAM_COUNT static_cast<size_t>(vl_event_stream::COUNT)
+
+// A single measurement from one of the device endpoints.
+//
+// time is in 48 MHz device ticks, unwrapped to 64 bits per stream.
+// The watchman streams carry the controller clock, see
+// vl_watchman_clock, which is not synchronized with the lighthouse
+// receiver clock of the headset.
+struct vl_event {
+    vl_event_stream stream;
+    uint64_t time;
+    union {
+        vive_headset_imu_sample imu;
+        vive_headset_lighthouse_pulse2 light;
+        vl_watchman_event controller;
+    };
+};
+
+typedef std::function<void(const vl_event&)> vl_event_sink;
+
+struct vl_event_merge_stats {
+    uint64_t emitted = 0;
+    // emitted because the latency bound expired or a buffer was full,
+    // instead of all active streams having caught up.
+    uint64_t forced = 0;
+    // dropped because they arrived after a later event was emitted.
+    uint64_t late = 0;
+};
+
+// The headset streams share the lighthouse receiver clock, every
+// watchman has its own.
+#define VL_EVENT_CLOCK_COUNT 3
+
+// Device clocks may run this much faster than the host, in ppm, see
+// vl_event_merge.
+#define VL_EVENT_MERGE_MAX_DRIFT 200
+
+// Time-ordered k-way merge of the device streams
+//
+// The device clocks are not synchronized, so every event is ordered by
+// its time on the host clock: its device time plus the offset of its
+// clock. The offset is the smallest difference between host arrival
+// and device time seen so far, the arrival with the least USB latency.
+// It is allowed to grow by VL_EVENT_MERGE_MAX_DRIFT, so a device clock
+// running slower than the host is followed as well.
+//
+// Every stream gets its own bounded reorder buffer. The oldest buffered
+// event is emitted once every active stream has an event buffered, so
+// nothing older can still arrive, or once it is older than the newest
+// event seen by more than latency_bound ticks. A stream without events
+// for longer than that is no longer waited for until it sends again.
+// The output is strictly ordered by host time, events arriving after a
+// later one was already emitted are dropped and counted. The emitted
+// events keep their device time.
+class vl_event_merge {
+    struct clock {
+        bool valid = false;
+        int64_t offset = 0;
+        uint64_t last_host = 0;
+    };
+
+    std::array<std::unique_ptr<vl_reorder_buffer<vl_event>>, VL_EVENT_STREAM_COUNT> buffers;
+    std::array<bool, VL_EVENT_STREAM_COUNT> active = {};
+    // host time of the last event per stream
+    std::array<uint64_t, VL_EVENT_STREAM_COUNT> last_seen = {};
+    std::array<clock, VL_EVENT_CLOCK_COUNT> clocks;
+    uint64_t latency_bound;
+    uint64_t newest = 0;
+    uint64_t last_emitted = 0;
+    bool emitted_any = false;
+    vl_event_sink sink;
+
+    uint64_t to_host_time(const vl_event& event, uint64_t arrival);
+    int oldest_stream() const;
+    void emit(int stream);
+    void drain(bool force);
+
+public:
+    vl_event_merge_stats stats;
+
+    vl_event_merge(const vl_event_sink& sink, uint64_t latency_bound, size_t buffer_size);
+    ~vl_event_merge() = default;
+
+    // Arrival is now.
+    void push(const vl_event& event);
+    // arrival in 48 MHz ticks of a host clock
+    void push(const vl_event& event, uint64_t arrival);
+    void flush();
+};
+
+// Default latency bound: 2ms, a bit more than one USB frame of jitter
+// between the interrupt endpoints.
+#define VL_EVENT_MERGE_LATENCY (48000000 / 500)
+#define VL_EVENT_MERGE_BUFFER_SIZE 64
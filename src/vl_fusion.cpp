@@ -28,35 +28,48 @@
 #include <memory>
 #include <string.h>
 #include "vl_fusion.h"
+#include "vl_log.h"
 #include "vl_math.h"
 
 vl_fusion::vl_fusion() {
     orientation =  Eigen::Quaterniond(1,0,0,0);
     fq_acceleration = std::make_unique<vl_filter_queue>(20);
     fq_angular_velocity = std::make_unique<vl_filter_queue>(20);
+    iterations = 0;
+    still_samples = 0;
+    grav_error_angle = 0;
+    grav_error_axis = Eigen::Vector3d::UnitX();
     grav_gain = 0.05f;
+    yaw_gain = 0.2;
+    gyro_bias = Eigen::Vector3d::Zero();
+    bias_gain = 0.01;
+    restored = false;
+    restored_yaw = 0;
+    startup_samples = 0;
+    startup_acceleration = Eigen::Vector3d::Zero();
+    startup_angular_velocity = Eigen::Vector3d::Zero();
+    elapsed = 0;
+    time_to_stable = -1;
 }
 
 
-#define GRAVITY_EARTH 9.82f
 
-
-Eigen::Quaterniond* vl_fusion::correct_gravity(const Eigen::Vector3d& acceleration, float ang_vel_length) {
-    const double gravity_tolerance = .4f, ang_vel_tolerance = .1f;
+Eigen::Quaterniond* vl_fusion::correct_gravity(float ang_vel_length) {
+    const double gravity_tolerance = .4f;
     const double min_tilt_error = 0.05f, max_tilt_error = 0.01f;
 
-    // if the device is within tolerance levels, count this as the device is level and add to the counter
-    // otherwise reset the counter and start over
-    if (ang_vel_length < ang_vel_tolerance && std::fabs(acceleration.norm() - GRAVITY_EARTH) < gravity_tolerance)
-        device_level_count++;
-
+    // count the samples the device is still, start over on motion
+    if (stillness.is_still())
+        still_samples++;
+    else
+        still_samples = 0;
 
-    // device has been level for long enough, grab mean from the accelerometer filter queue (last n values)
-    // and use for correction
-    if(device_level_count > 50){
-        device_level_count = 0;
+    // device has been still for a whole window, the mean of the window
+    // is gravity, use it for correction
+    if (still_samples >= VL_STILLNESS_WINDOW) {
+        still_samples = 0;
 
-        Eigen::Vector3d acceleration_mean = this->fq_acceleration->get_mean();
+        Eigen::Vector3d acceleration_mean = orientation * stillness.accel_mean();
         acceleration_mean.normalize();
 
         // Calculate a cross product between what the device
@@ -66,6 +79,11 @@ Eigen::Quaterniond* vl_fusion::correct_gravity(const Eigen::Vector3d& accelerati
         Eigen::Vector3d up = Eigen::Vector3d::UnitY();
         double tilt_angle = get_angle_between_vectors(up, acceleration_mean);
 
+        if (time_to_stable < 0 && tilt_angle < min_tilt_error) {
+            time_to_stable = elapsed;
+            vl_info("Orientation stable after %.0fms", time_to_stable * 1000.0);
+        }
+
         if(tilt_angle > max_tilt_error){
             Eigen::Vector3d tilt_e = Eigen::Vector3d(
                         acceleration_mean.z(),
@@ -117,10 +135,79 @@ Eigen::Vector3d vl_filter_queue::get_mean()
 }
 
 
-void vl_fusion::update(float dt, const Eigen::Vector3d& angular_velocity, const Eigen::Vector3d& acceleration)
+// Start from the mean of the first samples instead of identity. The
+// mean acceleration is up, which fixes the tilt at once, and a still
+// device gives the gyro bias as well.
+void vl_fusion::seed()
+{
+    Eigen::Vector3d acceleration_mean = startup_acceleration / startup_samples;
+    orientation = Eigen::Quaterniond::FromTwoVectors(acceleration_mean, Eigen::Vector3d::UnitY());
+
+    if (restored) {
+        double yaw = restored_yaw - get_yaw(orientation);
+        orientation = Eigen::Quaterniond(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitY())) * orientation;
+    }
+
+    if (stillness.is_still())
+        gyro_bias = startup_angular_velocity / startup_samples;
+
+    vl_info("Seeded orientation from %u samples after %.0fms%s", startup_samples,
+            elapsed * 1000.0, stillness.is_still() ? ", with gyro bias" : "");
+}
+
+vl_fusion_state vl_fusion::get_state()
+{
+    std::lock_guard<std::mutex> lock(mutex_fusion_update);
+
+    vl_fusion_state state;
+    state.orientation = orientation;
+    state.gyro_bias = gyro_bias;
+    state.started = startup_samples >= VL_FUSION_STARTUP_SAMPLES;
+    return state;
+}
+
+void vl_fusion::set_state(const vl_fusion_state& state)
+{
+    std::lock_guard<std::mutex> lock(mutex_fusion_update);
+
+    orientation = state.orientation.normalized();
+    gyro_bias = state.gyro_bias;
+    grav_error_angle = 0;
+    grav_error_axis = Eigen::Vector3d::UnitX();
+    restored = true;
+    restored_yaw = get_yaw(orientation);
+}
+
+// While still, the gyro reads its bias. Learn it slower the less sure
+// the detector is.
+void vl_fusion::update_gyro_bias()
+{
+    if (!stillness.is_still())
+        return;
+
+    gyro_bias += bias_gain * stillness.probability() * (stillness.gyro_mean() - gyro_bias);
+}
+
+void vl_fusion::update(float dt, const Eigen::Vector3d& raw_angular_velocity, const Eigen::Vector3d& acceleration, bool correct)
 {
     mutex_fusion_update.lock();
 
+    elapsed += dt;
+    stillness.update(raw_angular_velocity, acceleration);
+
+    if (startup_samples < VL_FUSION_STARTUP_SAMPLES) {
+        startup_acceleration += acceleration;
+        startup_angular_velocity += raw_angular_velocity;
+        startup_samples++;
+        if (startup_samples == VL_FUSION_STARTUP_SAMPLES)
+            seed();
+        mutex_fusion_update.unlock();
+        return;
+    }
+
+    update_gyro_bias();
+
+    Eigen::Vector3d angular_velocity = raw_angular_velocity - gyro_bias;
     Eigen::Vector3d acceleration_world = orientation * acceleration;
 
     iterations += 1;
@@ -137,10 +224,12 @@ void vl_fusion::update(float dt, const Eigen::Vector3d& angular_velocity, const
     }
 
     // gravity correction
-    Eigen::Quaterniond* correction = correct_gravity(acceleration, ang_vel_length);
-    if (correction != nullptr) {
-        orientation = *correction * orientation;
-        delete(correction);
+    if (correct) {
+        Eigen::Quaterniond* correction = correct_gravity(ang_vel_length);
+        if (correction != nullptr) {
+            orientation = *correction * orientation;
+            delete(correction);
+        }
     }
 
     // mitigate drift due to floating point
@@ -150,3 +239,14 @@ void vl_fusion::update(float dt, const Eigen::Vector3d& angular_velocity, const
     // print_eigen_quat("pose", *orientation);
     mutex_fusion_update.unlock();
 }
+
+void vl_fusion::correct_yaw(double yaw)
+{
+    mutex_fusion_update.lock();
+
+    // gravity keeps Y up, see correct_gravity()
+    orientation = Eigen::Quaterniond(Eigen::AngleAxisd(yaw_gain * yaw, Eigen::Vector3d::UnitY())) * orientation;
+    orientation.normalize();
+
+    mutex_fusion_update.unlock();
+}
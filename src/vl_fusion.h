@@ -31,6 +31,11 @@
 #include <memory>
 #include <mutex>
 
+#include "vl_stillness.h"
+
+// IMU samples averaged to seed the orientation, 100ms at 1000 Hz.
+#define VL_FUSION_STARTUP_SAMPLES VL_STILLNESS_WINDOW
+
 #define FILTER_QUEUE_MAX_SIZE 256
 class vl_filter_queue {
     unsigned size;
@@ -45,6 +50,16 @@ public:
     Eigen::Vector3d get_mean();
 };
 
+// Learned fusion state, restored across runs, see vl_checkpoint.h.
+struct vl_fusion_state {
+    Eigen::Quaterniond orientation;
+    Eigen::Vector3d gyro_bias;
+    // past the startup, not saved
+    bool started = false;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
 class vl_fusion {
 private:
     std::mutex mutex_fusion_update;
@@ -58,18 +73,58 @@ private:
     std::unique_ptr<vl_filter_queue> fq_acceleration;
     std::unique_ptr<vl_filter_queue> fq_angular_velocity;
 
+    vl_stillness stillness;
+
+    // startup, see seed()
+    bool restored;
+    double restored_yaw;
+    unsigned startup_samples;
+    Eigen::Vector3d startup_acceleration;
+    Eigen::Vector3d startup_angular_velocity;
+    double elapsed; // seconds of IMU time since the first sample
+    double time_to_stable;
+
+    void seed();
+
 	// gravity correction
-    int device_level_count;
+    unsigned still_samples; // since the last tilt measurement
     double grav_error_angle;
     Eigen::Vector3d grav_error_axis;
     double grav_gain; // amount of correction
 
-    Eigen::Quaterniond* correct_gravity(const Eigen::Vector3d& acceleration, float ang_vel_length);
+    double yaw_gain; // share of an optical yaw correction applied
+
+    // gyro bias learned while still
+    Eigen::Vector3d gyro_bias;
+    double bias_gain;
+
+    void update_gyro_bias();
+
+    Eigen::Quaterniond* correct_gravity(float ang_vel_length);
 
 public:
     Eigen::Quaterniond orientation;
 
     vl_fusion();
     ~vl_fusion() = default;
-    void update(float dt, const Eigen::Vector3d &vec3_gyro, const Eigen::Vector3d &vec3_accel);
+    // Without correct, only the gyro is integrated, see vl_scheduler.
+    void update(float dt, const Eigen::Vector3d &vec3_gyro, const Eigen::Vector3d &vec3_accel, bool correct = true);
+    // Rotate by part of yaw about the world up axis, to cancel the drift
+    // measured by vl_heading_tracker.
+    void correct_yaw(double yaw);
+
+    const vl_stillness& get_stillness() const { return stillness; }
+    const Eigen::Vector3d& get_gyro_bias() const { return gyro_bias; }
+    // Seconds from the first sample until gravity first agreed with the
+    // orientation within 3 degrees, negative until then.
+    double get_time_to_stable() const { return time_to_stable; }
+    // Past the startup, the orientation is seeded.
+    bool is_started() const { return startup_samples >= VL_FUSION_STARTUP_SAMPLES; }
+
+    vl_fusion_state get_state();
+    // Warm start. The tilt still comes from the first samples, as the
+    // device may have been moved in between, but the heading and the
+    // bias carry over. The gravity error is not kept, it belonged to
+    // the old tilt.
+    void set_state(const vl_fusion_state& state);
 };
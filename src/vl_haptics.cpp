@@ -0,0 +1,179 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "vl_haptics.h"
+#include "vl_log.h"
+
+static std::chrono::microseconds pulse_span(const vl_haptic_pulse& pulse) {
+    // up to 2^33 us, too long for int
+    return std::chrono::microseconds((int64_t) (pulse.high_us + pulse.low_us) * (pulse.repeat + 1));
+}
+
+// The stronger pulse, running as long as the longer one.
+static vl_haptic_pulse merge_pulses(const vl_haptic_pulse& a, const vl_haptic_pulse& b) {
+    vl_haptic_pulse merged = a.high_us >= b.high_us ? a : b;
+    int64_t span = std::max(pulse_span(a), pulse_span(b)).count();
+    int64_t period = std::max(1, merged.high_us + merged.low_us);
+    merged.repeat = std::min<int64_t>(UINT16_MAX, (span + period - 1) / period - 1);
+    return merged;
+}
+
+vl_haptics::vl_haptics(libusb_context* context, const std::array<libusb_device_handle*, VL_HAPTICS_CONTROLLERS>& dongles)
+    : context(context) {
+    for (unsigned i = 0; i < VL_HAPTICS_CONTROLLERS; i++) {
+        controller& c = controllers[i];
+        c.haptics = this;
+        c.handle = dongles[i];
+        if (!c.handle)
+            continue;
+        c.transfer = libusb_alloc_transfer(0);
+        if (!c.transfer)
+            vl_error("Failed to allocate memory for USB transfer");
+    }
+}
+
+vl_haptics::~vl_haptics() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (controller& c : controllers)
+        if (c.in_flight)
+            libusb_cancel_transfer(c.transfer);
+
+    // the completions still refer to this
+    auto in_flight = [this] {
+        return std::any_of(controllers.begin(), controllers.end(),
+                           [](const controller& c) { return c.in_flight; });
+    };
+    while (in_flight()) {
+        lock.unlock();
+        timeval timeout = { 0, 100000 };
+        libusb_handle_events_timeout(context, &timeout);
+        lock.lock();
+    }
+
+    for (controller& c : controllers)
+        libusb_free_transfer(c.transfer);
+}
+
+bool vl_haptics::pulse(unsigned index, const vl_haptic_pulse& request) {
+    if (index >= VL_HAPTICS_CONTROLLERS || !controllers[index].transfer)
+        return false;
+
+    vl_haptic_pulse pulse = request;
+    pulse.high_us = std::min<uint16_t>(pulse.high_us, VL_HAPTICS_MAX_PULSE_US);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    controller& c = controllers[index];
+    stats.requested++;
+
+    auto now = std::chrono::steady_clock::now();
+    if (c.has_pending) {
+        c.pending = merge_pulses(c.pending, pulse);
+        stats.coalesced++;
+    } else if (now + pulse_span(pulse) <= c.busy_until && pulse.high_us <= c.running.high_us) {
+        // felt as part of the pulse still running
+        stats.coalesced++;
+        return true;
+    } else {
+        c.pending = pulse;
+        c.has_pending = true;
+    }
+
+    dispatch_locked();
+    return true;
+}
+
+void vl_haptics::dispatch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    dispatch_locked();
+}
+
+bool vl_haptics::poll(std::chrono::microseconds timeout) {
+    dispatch();
+
+    timeval tv = { (time_t) (timeout.count() / 1000000), (suseconds_t) (timeout.count() % 1000000) };
+    libusb_handle_events_timeout(context, &tv);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    dispatch_locked();
+    return std::any_of(controllers.begin(), controllers.end(),
+                       [](const controller& c) { return c.has_pending || c.in_flight; });
+}
+
+void vl_haptics::dispatch_locked() {
+    auto now = std::chrono::steady_clock::now();
+    for (controller& c : controllers) {
+        if (!c.has_pending || c.in_flight || now - c.sent < VL_HAPTICS_MIN_INTERVAL)
+            continue;
+        if (!send(c))
+            stats.failed++;
+        c.has_pending = false;
+    }
+}
+
+bool vl_haptics::send(controller& c) {
+    uint8_t* setup = c.buffer.data();
+    uint8_t* data = setup + LIBUSB_CONTROL_SETUP_SIZE;
+    uint16_t length = c.buffer.size() - LIBUSB_CONTROL_SETUP_SIZE;
+
+    vl_controller_haptic_command command = vl_controller_haptic(c.pending.high_us, c.pending.low_us, c.pending.repeat);
+    memcpy(data, command.data(), command.size());
+
+    libusb_fill_control_setup(setup,
+                              LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE | LIBUSB_ENDPOINT_OUT,
+                              0x09/*HID set_report*/,
+                              (3/*HID feature*/ << 8) | data[0],
+                              VL_HAPTICS_INTERFACE,
+                              length);
+    libusb_fill_control_transfer(c.transfer, c.handle, setup, transfer_done, &c, 1000/*timeout millis*/);
+
+    libusb_error ret = static_cast<libusb_error>(libusb_submit_transfer(c.transfer));
+    if (ret != LIBUSB_SUCCESS) {
+        vl_debug("Failed to submit haptic pulse: %s", libusb_strerror(ret));
+        return false;
+    }
+
+    c.in_flight = true;
+    c.running = c.pending;
+    c.sent = std::chrono::steady_clock::now();
+    c.busy_until = c.sent + pulse_span(c.running);
+    stats.sent++;
+
+    return true;
+}
+
+void vl_haptics::transfer_done(libusb_transfer* transfer) {
+    controller* c = static_cast<controller*>(transfer->user_data);
+    vl_haptics* haptics = c->haptics;
+
+    std::lock_guard<std::mutex> lock(haptics->mutex);
+    c->in_flight = false;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+            vl_debug("Haptic pulse transfer failed: %d", transfer->status);
+        haptics->stats.failed++;
+        c->busy_until = c->sent;
+        return;
+    }
+
+    haptics->dispatch_locked();
+}
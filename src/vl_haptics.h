@@ -0,0 +1,101 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include <libusb.h>
+
+#include "vl_magic.h"
+
+#define VL_HAPTICS_CONTROLLERS 2
+
+// SteamVR allows one pulse per 5ms, the dongle is given the same.
+#define VL_HAPTICS_MIN_INTERVAL std::chrono::milliseconds(5)
+#define VL_HAPTICS_MAX_PULSE_US 3999
+
+// Interface of the watchman dongle that takes controller commands.
+#define VL_HAPTICS_INTERFACE 1
+
+// A train of repeat + 1 pulses, each on for high_us and off for
+// low_us. The on time sets the strength.
+struct vl_haptic_pulse {
+    uint16_t high_us;
+    uint16_t low_us;
+    uint16_t repeat;
+};
+
+struct vl_haptics_stats {
+    uint64_t requested = 0;
+    // merged into a waiting pulse or covered by the one running
+    uint64_t coalesced = 0;
+    uint64_t sent = 0;
+    uint64_t failed = 0;
+};
+
+// Non-blocking haptics for both controllers
+//
+// pulse() only queues, any thread may call it. Every controller has at
+// most one pulse waiting and one control transfer in flight. Requests
+// that arrive meanwhile are merged into the waiting one, which is sent
+// once the transfer completed and VL_HAPTICS_MIN_INTERVAL passed, from
+// pulse() or from dispatch() on the event loop, see vl_driver::poll().
+class vl_haptics {
+    struct controller {
+        vl_haptics* haptics = nullptr;
+        libusb_device_handle* handle = nullptr;
+        libusb_transfer* transfer = nullptr;
+        std::array<uint8_t, LIBUSB_CONTROL_SETUP_SIZE + std::tuple_size<vl_controller_haptic_command>::value> buffer;
+
+        vl_haptic_pulse pending;
+        bool has_pending = false;
+        bool in_flight = false;
+
+        // the pulse last sent and until when it runs
+        vl_haptic_pulse running;
+        std::chrono::steady_clock::time_point sent;
+        std::chrono::steady_clock::time_point busy_until;
+    };
+
+    libusb_context* context;
+    std::array<controller, VL_HAPTICS_CONTROLLERS> controllers;
+    std::mutex mutex;
+
+    void dispatch_locked();
+    bool send(controller& c);
+    static void transfer_done(libusb_transfer* transfer);
+
+public:
+    vl_haptics_stats stats;
+
+    vl_haptics(libusb_context* context, const std::array<libusb_device_handle*, VL_HAPTICS_CONTROLLERS>& dongles);
+    ~vl_haptics();
+
+    // Returns false for an unknown controller or a dongle not open.
+    bool pulse(unsigned controller, const vl_haptic_pulse& pulse);
+    void dispatch();
+    // For callers without an event loop: dispatch and handle transfer
+    // completions for up to timeout. Returns false once no pulse is
+    // waiting or in flight.
+    bool poll(std::chrono::microseconds timeout);
+};
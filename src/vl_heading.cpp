@@ -0,0 +1,133 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <cmath>
+
+#include "vl_heading.h"
+#include "vl_log.h"
+#include "vl_p3p.h"
+#include "vl_parallel.h"
+
+#define HEADING_ITERATIONS 5
+
+vl_heading_tracker::vl_heading_tracker(const vl_model_points& model) : model(model) {
+}
+
+// Rotation about the world up axis, Y as in vl_fusion::correct_gravity().
+static Eigen::Matrix3d yaw_rotation(double yaw) {
+    return Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitY()).toRotationMatrix();
+}
+
+bool vl_heading_tracker::update(const vl_light_frame& frame,
+                                const Eigen::Quaterniond& orientation,
+                                double* yaw,
+                                const Eigen::Matrix3d& station_from_room) {
+    Eigen::Matrix3d world_from_model = orientation.toRotationMatrix();
+
+    if (!calibrated) {
+        // Called on the USB event thread. The few triples tried cost
+        // less than starting a thread per core.
+        vl_parallel_serial serial;
+        Eigen::Isometry3d model_to_station;
+        if (!vl_p3p_acquire(frame, model, vl_model_normals(), &model_to_station, &rms) ||
+                rms > VL_LIGHT_MAX_REPROJECTION)
+            return false;
+        room_from_world = station_from_room.transpose() * model_to_station.linear() * world_from_model.transpose();
+        calibrated = true;
+        vl_info("Heading reference set from %u sensor hits, residual %g.",
+                __builtin_popcount(frame.visible), rms);
+        return false;
+    }
+
+    // fixed size, so the solve does not allocate
+    Eigen::Matrix<double, 3, VL_HEADING_MAX_SENSORS> points;
+    Eigen::Matrix<double, 2, VL_HEADING_MAX_SENSORS> measured;
+    unsigned n = 0;
+    for (unsigned s = 0; s < VL_MAX_SENSORS && s < model.size() && n < VL_HEADING_MAX_SENSORS; s++) {
+        if (!is_sensor_visible(frame, s))
+            continue;
+        points.col(n) = world_from_model * model[s];
+        measured(0, n) = std::tan(angle_ticks_to_rad(frame.x[s]));
+        measured(1, n) = std::tan(angle_ticks_to_rad(frame.y[s]));
+        n++;
+    }
+
+    if (n < 3)
+        return false;
+
+    Eigen::Matrix3d station_from_world = station_from_room * room_from_world;
+
+    // Position at zero yaw error: each point must lie on its ray d, so
+    // (I - d d^T)(R m + t) = 0, linear least squares in t.
+    Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d b = Eigen::Vector3d::Zero();
+    for (unsigned i = 0; i < n; i++) {
+        Eigen::Vector3d d = Eigen::Vector3d(measured(0, i), measured(1, i), 1.0).normalized();
+        Eigen::Matrix3d P = Eigen::Matrix3d::Identity() - d * d.transpose();
+        A += P;
+        b -= P * (station_from_world * points.col(i));
+    }
+    Eigen::Vector3d t = A.ldlt().solve(b);
+
+    // Gauss-Newton on x = [yaw, t]
+    double psi = 0;
+    double sum = 0;
+    for (int iteration = 0; iteration < HEADING_ITERATIONS; iteration++) {
+        Eigen::Matrix4d JtJ = Eigen::Matrix4d::Zero();
+        Eigen::Vector4d Jtr = Eigen::Vector4d::Zero();
+        sum = 0;
+
+        for (unsigned i = 0; i < n; i++) {
+            Eigen::Vector3d q = yaw_rotation(psi) * points.col(i);
+            Eigen::Vector3d p = station_from_world * q + t;
+            if (p.z() <= 0)
+                return false;
+
+            Eigen::Vector2d r(p.x() / p.z() - measured(0, i),
+                              p.y() / p.z() - measured(1, i));
+            sum += r.squaredNorm();
+
+            Eigen::Matrix<double, 2, 3> dproj;
+            dproj << 1.0 / p.z(), 0, -p.x() / (p.z() * p.z()),
+                     0, 1.0 / p.z(), -p.y() / (p.z() * p.z());
+
+            Eigen::Matrix<double, 3, 4> dp;
+            dp.col(0) = station_from_world * Eigen::Vector3d::UnitY().cross(q);
+            dp.rightCols<3>() = Eigen::Matrix3d::Identity();
+
+            Eigen::Matrix<double, 2, 4> J = dproj * dp;
+            JtJ += J.transpose() * J;
+            Jtr += J.transpose() * r;
+        }
+
+        Eigen::Vector4d delta = JtJ.ldlt().solve(-Jtr);
+        psi += delta(0);
+        t += delta.tail<3>();
+
+        if (delta.squaredNorm() < 1e-14)
+            break;
+    }
+
+    rms = std::sqrt(sum / n);
+    if (!std::isfinite(psi) || rms > VL_LIGHT_MAX_REPROJECTION)
+        return false;
+
+    *yaw = std::remainder(psi, 2.0 * M_PI);
+    return true;
+}
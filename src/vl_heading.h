@@ -0,0 +1,68 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <Eigen/Geometry>
+
+#include "vl_hid_reports.h"
+#include "vl_light.h"
+#include "vl_triangulate.h"
+
+// Sensors used per heading solve, the first ones visible.
+#define VL_HEADING_MAX_SENSORS 6
+
+// Heading of the IMU orientation from a single base station
+//
+// Gravity already fixes the tilt of the fusion orientation, so a frame
+// of sweep hits only has to pin down yaw about the world up axis and
+// the device position: 4 unknowns, solved by a few Gauss-Newton steps
+// on a fixed size system, instead of a full 6-DoF pose.
+//
+// The first frame seen is solved in full with P3P to find the station
+// orientation in the fusion world frame. The heading at that moment is
+// the reference, later frames measure the yaw drift from it.
+//
+// With a room setup, frames carry the orientation of their station in
+// the room, so the reference holds for both stations of the room.
+class vl_heading_tracker {
+    vl_model_points model;
+    bool calibrated = false;
+    // room from fusion world rotation
+    Eigen::Matrix3d room_from_world;
+
+public:
+    // root mean square reprojection error of the last solve
+    double rms = 0;
+
+    vl_heading_tracker(const vl_model_points& model);
+
+    // Yaw to apply to orientation to cancel its drift, in radians about
+    // the world up axis. Returns false while calibrating or when the
+    // frame has fewer than 3 usable sensors or the fit is bad.
+    // station_from_room is the rotation of the frame's station, see
+    // vl_room_setup, the identity without a room setup.
+    bool update(const vl_light_frame& frame, const Eigen::Quaterniond& orientation, double* yaw,
+                const Eigen::Matrix3d& station_from_room = Eigen::Matrix3d::Identity());
+
+    bool is_calibrated() const { return calibrated; }
+    void reset() { calibrated = false; }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
@@ -129,9 +129,11 @@ struct vive_controller_ping_message {
 	__u8 unknown2[5];
 } __attribute__((packed));
 
+// Fixed layout of the first message in a slot, see vl_watchman.h for
+// the variable length parser.
 struct vive_controller_message {
 	__u8 time1;
-	__u8 sensor_id;
+	__u8 length;
 	__u8 time2;
 	__u8 type;
 	union {
@@ -0,0 +1,105 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "vl_input.h"
+
+static const uint8_t buttons[] = {
+    vl_controller_button::TRIGGER,
+    vl_controller_button::TOUCH,
+    vl_controller_button::TOUCH_PRESS,
+    vl_controller_button::SYSTEM,
+    vl_controller_button::GRIP,
+    vl_controller_button::MENU,
+};
+
+bool vl_input_tracker::push(vl_input_queue* queue, const vl_input_event& event) {
+    if (queue->push(event))
+        return true;
+    dropped++;
+    return false;
+}
+
+void vl_input_tracker::update_axis(unsigned controller, vl_input_axis axis, float value, uint64_t time, vl_input_queue* queue) {
+    float& last = controllers[controller].axes[static_cast<size_t>(axis)];
+    if (value == last)
+        return;
+
+    bool at_end = value == 0.0f || std::abs(value) == 1.0f;
+    if (!at_end && std::abs(value - last) < VL_INPUT_AXIS_THRESHOLD)
+        return;
+
+    vl_input_event event = {};
+    event.time = time;
+    event.controller = controller;
+    event.type = vl_input_event_type::AXIS;
+    event.axis = axis;
+    event.value = value;
+    if (push(queue, event))
+        last = value;
+}
+
+void vl_input_tracker::update(unsigned controller, const vl_watchman_event& event, uint64_t time, vl_input_queue* queue) {
+    if (controller >= VL_WATCHMAN_CONTROLLERS)
+        return;
+
+    switch (event.type) {
+    case vl_watchman_event_type::BUTTONS: {
+        uint8_t& state = controllers[controller].buttons;
+        uint8_t changed = state ^ event.buttons;
+        for (uint8_t button : buttons) {
+            if (!(changed & button))
+                continue;
+            vl_input_event input = {};
+            input.time = time;
+            input.controller = controller;
+            input.type = event.buttons & button ? vl_input_event_type::PRESS : vl_input_event_type::RELEASE;
+            input.button = button;
+            // a lost edge is tried again with the next message
+            if (push(queue, input))
+                state ^= button;
+        }
+        break;
+    }
+    case vl_watchman_event_type::TRIGGER:
+        update_axis(controller, vl_input_axis::TRIGGER, event.trigger / 255.0f, time, queue);
+        break;
+    case vl_watchman_event_type::TRACKPAD:
+        update_axis(controller, vl_input_axis::TRACKPAD_X, std::max(-1.0f, event.trackpad.x / 32767.0f), time, queue);
+        update_axis(controller, vl_input_axis::TRACKPAD_Y, std::max(-1.0f, event.trackpad.y / 32767.0f), time, queue);
+        break;
+    default:
+        break;
+    }
+}
+
+void vl_input_tracker::reset(unsigned controller, uint64_t time, vl_input_queue* queue) {
+    if (controller >= VL_WATCHMAN_CONTROLLERS)
+        return;
+
+    vl_watchman_event released = {};
+    released.type = vl_watchman_event_type::BUTTONS;
+    released.buttons = 0;
+    update(controller, released, time, queue);
+
+    for (size_t axis = 0; axis < VL_INPUT_AXIS_COUNT; axis++)
+        update_axis(controller, static_cast<vl_input_axis>(axis), 0.0f, time, queue);
+}
@@ -0,0 +1,87 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "vl_spsc_queue.h"
+#include "vl_watchman.h"
+
+#define VL_INPUT_QUEUE_SIZE 256
+
+// Smallest axis change reported, of the full range. The ends of the
+// range are always reported.
+#define VL_INPUT_AXIS_THRESHOLD 0.01f
+
+enum class vl_input_event_type : uint8_t {
+    PRESS,
+    RELEASE,
+    AXIS,
+};
+
+enum class vl_input_axis : uint8_t {
+    TRIGGER, // 0 to 1
+    TRACKPAD_X, // -1 to 1
+    TRACKPAD_Y,
+    COUNT,
+};
+
+#define VL_INPUT_AXIS_COUNT static_cast<size_t>(vl_input_axis::COUNT)
+
+// A change of the controller input
+//
+// time is in controller ticks, see vl_watchman_clock. button is one of
+// vl_controller_button, for PRESS and RELEASE.
+struct vl_input_event {
+    uint64_t time;
+    uint8_t controller;
+    vl_input_event_type type;
+    uint8_t button;
+    vl_input_axis axis;
+    float value;
+};
+
+typedef vl_spsc_queue<vl_input_event, VL_INPUT_QUEUE_SIZE> vl_input_queue;
+
+// Turns controller messages into input changes
+//
+// The last state of every controller is kept, a message only yields
+// events for what differs from it. Buttons start released, the first
+// message presses the ones held.
+class vl_input_tracker {
+    struct controller_state {
+        uint8_t buttons = 0;
+        std::array<float, VL_INPUT_AXIS_COUNT> axes = {};
+    };
+
+    std::array<controller_state, VL_WATCHMAN_CONTROLLERS> controllers;
+
+    bool push(vl_input_queue* queue, const vl_input_event& event);
+    void update_axis(unsigned controller, vl_input_axis axis, float value, uint64_t time, vl_input_queue* queue);
+
+public:
+    // events lost to a full queue
+    uint64_t dropped = 0;
+
+    void update(unsigned controller, const vl_watchman_event& event, uint64_t time, vl_input_queue* queue);
+    // Releases all buttons and centers the axes, like on a disconnect.
+    void reset(unsigned controller, uint64_t time, vl_input_queue* queue);
+};
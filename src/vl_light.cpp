@@ -1,3 +1,5 @@
+#include <climits>
+#include <cmath>
 #include <functional>
 #include <vector>
 #include <string>
@@ -5,13 +7,12 @@
 #include <map>
 
 #include <fstream>
-
-#include <opencv2/core.hpp>
-#include <opencv2/calib3d.hpp>
+#include <sstream>
 
 #include "vl_messages.h"
 #include "vl_light.h"
 #include "vl_log.h"
+#include "vl_reorder.h"
 
 double median_timestamp(const vl_lighthouse_samples& samples) {
     std::vector<double> timestamps;
@@ -74,7 +75,7 @@ lighthouse_sync_pulse lookup_pulse_class(uint16_t pulselen) {
         if (pulselen > (pulse_table[i].duration - 250) &&
                 pulselen < (pulse_table[i].duration + 250))
             return pulse_table[i];
-    vl_error("no pulse class found for length %u", pulselen);
+    vl_debug("no pulse class found for length %u", pulselen);
     return lighthouse_sync_pulse();
 }
 
@@ -99,7 +100,7 @@ std::tuple<int,int,int> decode_pulse(const vl_lighthouse_samples& S) {
 
     // not fatal
     if (ndups != 0)
-        vl_warn("Warning: %d duplicate sensors", ndups);
+        vl_debug("Warning: %d duplicate sensors", ndups);
 
     // robust against outlier samples
     uint16_t pulselen = median_length(S);
@@ -189,6 +190,20 @@ uint32_t ticks_sample_to_angle(const vive_headset_lighthouse_pulse2& sample, uin
     return angle_ticks;
 }
 
+// Convert angle ticks to radians
+//
+// rad = angle_ticks_to_rad(ticks)
+//
+//	ticks	angle ticks relative to the sweep epoch
+//
+//	rad	The sweep angle, 0 being the optical axis of the station,
+//		which the rotor passes a quarter rotation after the sync pulse.
+
+double angle_ticks_to_rad(uint32_t ticks) {
+    const double ticks_per_rotation = VL_TICK_RATE / VL_ROTOR_RPS;
+    return (ticks - ticks_per_rotation / 4.0) * 2.0 * M_PI / ticks_per_rotation;
+}
+
 // Convert tick-delta to millimeters
 //
 // mm = ticks_to_mm(ticks, dist)
@@ -235,15 +250,15 @@ vl_light_sample_group process_pulse_set(const vl_lighthouse_samples& S, int64_t
     char sweep = key[sweepi + 1];
 
     if (S.size() < 5)
-        vl_warn("Warning: channel %c pulse at %.1f (len %ld, samples %zu): skip %d, sweep %c, data %d\n",
+        vl_debug("Warning: channel %c pulse at %.1f (len %ld, samples %zu): skip %d, sweep %c, data %d\n",
             ch, t, median_length(S), S.size(), skip, sweep, databit);
 
-    // no use for databit here
     vl_light_sample_group p = {
         /*channel*/ ch,
         /*sweep*/ sweep,
         /*epoch*/ t,
         /*skip*/ skip,
+        /*data*/ databit,
         /*seq*/ 0,
         /*samples*/ vl_lighthouse_samples()
     };
@@ -270,6 +285,8 @@ vl_light_sample_group process_pulse_set(const vl_lighthouse_samples& S, int64_t
 //			- sweep: 'H' or 'V'
 //			Can be empty due to detection errors.
 //	seq		scanning cycle sequence number
+//	ootx		Optional OOTX decoders, the data bit of every valid
+//			pulse is fed to the decoder of its channel.
 //
 // Outputs:
 //	out_pulse	Only set for valid non-skipped pulses. A struct
@@ -284,7 +301,8 @@ std::tuple<double, vl_light_sample_group, int, vl_light_sample_group> update_pul
         const vl_lighthouse_samples& pulse_samples,
         double last_pulse_epoch,
         vl_light_sample_group current_sweep,
-        int seq) {
+        int seq,
+        vl_ootx_decoders* ootx) {
 
     vl_light_sample_group out_pulse = vl_light_sample_group();
     vl_light_sample_group pulse = process_pulse_set(pulse_samples, last_pulse_epoch);
@@ -300,6 +318,10 @@ std::tuple<double, vl_light_sample_group, int, vl_light_sample_group> update_pul
                     last_pulse_epoch, current_sweep, seq, out_pulse);
     }
 
+    // Every station sends one data bit per sync pulse, skipped or not.
+    if (ootx && pulse.data >= 0)
+        (*ootx)[pulse.channel].push_bit(pulse.data);
+
     if (pulse.skip == 0) {
         // Valid pulse starting a new sweep.
 
@@ -308,7 +330,7 @@ std::tuple<double, vl_light_sample_group, int, vl_light_sample_group> update_pul
         if ((pulse.channel == 'A' || pulse.channel == 'B') && pulse.sweep == 'H')
             seq += 1;
 
-        vl_info("Start sweep seq %d: ch %c, sweep %c, pulse detected by %zu sensors",
+        vl_debug("Start sweep seq %d: ch %c, sweep %c, pulse detected by %zu sensors",
                 seq, pulse.channel, pulse.sweep, pulse_samples.size());
 
         current_sweep = pulse;
@@ -319,6 +341,7 @@ std::tuple<double, vl_light_sample_group, int, vl_light_sample_group> update_pul
             /*sweep*/ pulse.sweep,
             /*epoch*/ pulse.epoch,
             /*skip*/ 0,
+            /*data*/ pulse.data,
             /*seq*/ seq,
             /*samples*/ pulse_samples
         };
@@ -368,14 +391,57 @@ vl_lighthouse_samples filter_samples_by_sensor_id(const vl_lighthouse_samples& s
     return filtered;
 }
 
-std::map<unsigned, vl_angles> collect_readings(char station, const std::vector<vl_light_sample_group>& sweeps) {
+unsigned count_visible_sensors(const vl_station_readings& readings) {
+    uint32_t seen = 0;
+    for (const vl_light_frame& frame : readings)
+        seen |= frame.visible;
+    return __builtin_popcount(seen);
+}
+
+bool vl_light_make_frame(int seq, const vl_light_sample_group& x_sweep,
+                         const vl_light_sample_group& y_sweep, vl_light_frame* frame) {
+    frame->seq = seq;
+    frame->t = x_sweep.epoch;
+    uint32_t x_seen = 0, y_seen = 0, duplicates = 0;
+
+    // one pass per sweep, only interested in sensors with both x and y
+    for (const vive_headset_lighthouse_pulse2& sample : x_sweep.samples) {
+        if (sample.sensor_id >= VL_MAX_SENSORS)
+            continue;
+        uint32_t bit = 1u << sample.sensor_id;
+        duplicates |= x_seen & bit;
+        x_seen |= bit;
+        frame->x[sample.sensor_id] = ticks_sample_to_angle(sample, x_sweep.epoch);
+    }
+
+    for (const vive_headset_lighthouse_pulse2& sample : y_sweep.samples) {
+        if (sample.sensor_id >= VL_MAX_SENSORS)
+            continue;
+        uint32_t bit = 1u << sample.sensor_id;
+        duplicates |= y_seen & bit;
+        y_seen |= bit;
+        frame->y[sample.sensor_id] = ticks_sample_to_angle(sample, y_sweep.epoch);
+    }
+
+    if (duplicates)
+        vl_error("error: Same sensor sampled multiple times?? (mask 0x%08x)", duplicates);
+
+    // Assumes all measurements happened at the same time,
+    // which is wrong.
+    frame->visible = x_seen & y_seen;
+
+    return frame->visible != 0;
+}
+
+vl_station_readings collect_readings(char station, const std::vector<vl_light_sample_group>& sweeps) {
     // Collect all readings into a nice data structure
     // x and y angles, and a timestamp (x sweep epoch)
-    // array R(sensor_id + 1).x, .y, .t
+    // one frame per sequence, indexed by sensor_id
 
-    std::map<unsigned, vl_angles> R;
+    vl_station_readings R;
 
     int maxseq = find_max_seq(sweeps);
+    R.reserve(maxseq);
 
     // loop over sequences
     for (int i = 1; i < maxseq; i++) {
@@ -385,9 +451,10 @@ std::map<unsigned, vl_angles> collect_readings(char station, const std::vector<v
         std::vector<vl_light_sample_group> y_sweeps = filter_sweeps(sweeps, station, i, 'V');
 
         if (x_sweeps.size() < 1 || y_sweeps.size() < 1) {
-            // Either or both sweeps are empty, ignore.
-            vl_warn("Warning: Either or both sweeps are empty, ignore.");
-            break;
+            // Either or both sweeps are empty, e.g. occluded or cut off
+            // at the start of a batch, skip this cycle.
+            vl_debug("Either or both sweeps of cycle %d are empty, ignore.", i);
+            continue;
         }
 
         if (x_sweeps.size() != 1 || y_sweeps.size() != 1)
@@ -396,45 +463,14 @@ std::map<unsigned, vl_angles> collect_readings(char station, const std::vector<v
 
         for (unsigned sweep_i = 0; sweep_i < x_sweeps.size(); sweep_i++) {
 
-            vl_light_sample_group x_sweep, y_sweep;
-
-            try {
-                x_sweep = x_sweeps.at(sweep_i);
-                y_sweep = y_sweeps.at(sweep_i);
-            } catch (std::out_of_range e) {
+            if (sweep_i >= y_sweeps.size()) {
                 vl_warn("Warning: one dimension is missing for sweep %u", sweep_i);
                 continue;
             }
 
-            //int max_sensor_id = find_max_sendor_id(x_sweep.samples);
-
-            // loop over sensors ids, only interested in both x and y
-            for (unsigned s = 0; s < 32; s++) {
-                vl_lighthouse_samples xi = filter_samples_by_sensor_id(x_sweep.samples, s);
-                vl_lighthouse_samples yi = filter_samples_by_sensor_id(y_sweep.samples, s);
-
-                if (xi.size() > 1 || yi.size() > 1)
-                    vl_error("error: Same sensor sampled multiple times??");
-
-                if (xi.size() < 1 || yi.size() < 1)
-                    continue;
-
-                if (!R.count( s ))
-                    R.insert(std::pair<unsigned, vl_angles>(s, vl_angles()));
-
-
-                double x_ang = ticks_sample_to_angle(xi[0], x_sweep.epoch);
-                double y_ang = ticks_sample_to_angle(yi[0], y_sweep.epoch);
-
-                R[s].x.push_back(x_ang);
-                R[s].y.push_back(y_ang);
-
-                // Assumes all measurements happened at the same time,
-                // which is wrong.
-                R[s].t.push_back(x_sweep.epoch);
-
-
-            }
+            vl_light_frame frame;
+            if (vl_light_make_frame(i, x_sweeps[sweep_i], y_sweeps[sweep_i], &frame))
+                R.push_back(frame);
         }
     }
     return R;
@@ -464,6 +500,52 @@ bool is_sample_valid(const vive_headset_lighthouse_pulse2& s) {
     return !(s.timestamp == 0xffffffff && s.sensor_id == 0xff && s.length == 0xffff);
 }
 
+vl_lighthouse_samples reorder_samples(const vl_lighthouse_samples& S, size_t window,
+                                      vl_light_reorder_stats* stats) {
+    vl_lighthouse_samples sorted;
+    sorted.reserve(S.size());
+
+    vl_light_reorder_stats local_stats;
+    if (!stats)
+        stats = &local_stats;
+
+    vl_reorder_buffer<vive_headset_lighthouse_pulse2> buffer(window);
+    vl_tick_unwrapper clock;
+    uint64_t newest = 0;
+    uint64_t last_out = 0;
+
+    auto pop = [&]() {
+        uint64_t time = buffer.front_time();
+        vive_headset_lighthouse_pulse2 sample = buffer.pop();
+        if (!sorted.empty() && time < last_out) {
+            stats->dropped++;
+            return;
+        }
+        last_out = time;
+        sorted.push_back(sample);
+    };
+
+    for (auto sample : S) {
+        uint64_t time = clock.unwrap(sample.timestamp);
+
+        if (time < newest) {
+            stats->reordered++;
+            stats->max_ticks = std::max(stats->max_ticks, static_cast<uint32_t>(newest - time));
+        } else {
+            newest = time;
+        }
+
+        if (buffer.full())
+            pop();
+        buffer.push(time, sample);
+    }
+
+    while (!buffer.empty())
+        pop();
+
+    return sorted;
+}
+
 // Process and classify Lighthouse samples
 //
 // [sweeps, pulses] = process_lighthouse_samples(D)
@@ -500,134 +582,200 @@ bool isempty(const vl_light_sample_group& samples) {
     return samples.samples.empty();
 }
 
-std::tuple<std::vector<vl_light_sample_group>, std::vector<vl_light_sample_group>> process_lighthouse_samples(const vl_lighthouse_samples& D) {
+vl_light_classifier::vl_light_classifier(size_t reorder_window) : buffer(reorder_window) {
+}
 
-    // state for the processing loop
-    std::vector<int> pulse_inds;
-    std::vector<int> sweep_inds;
+void vl_light_classifier::end_pulse_set() {
+    vl_light_sample_group pulse;
+    std::tie(last_pulse_epoch, current_sweep, seq, pulse) = update_pulse_state(pulse_samples, last_pulse_epoch, current_sweep, seq, &ootx);
 
-    double last_pulse_epoch = -1e6;
-    int seq = 0;
+    pulse_samples.clear();
+    pulse_range = {UINT32_MAX, 0};
+    if (!isempty(pulse) && pulse_sink)
+        pulse_sink(pulse);
+}
 
-    vl_light_sample_group current_sweep = vl_light_sample_group();
-    //pulse_range = [Inf -Inf]; // begin, end timestamp
-    std::pair<uint32_t, uint32_t> pulse_range = {UINT32_MAX, 0};
+void vl_light_classifier::end_sweep() {
+    vl_light_sample_group sweep = {
+        /*channel*/ current_sweep.channel,
+        /*sweep*/ current_sweep.sweep,
+        /*epoch*/ current_sweep.epoch,
+        /*skip*/ 0,
+        /*data*/ 0,
+        /*seq*/ seq,
+        /*samples*/ vl_lighthouse_samples()
+    };
+    std::swap(sweep.samples, sweep_samples);
 
-    std::vector<vl_light_sample_group> pulses;
-    std::vector<vl_light_sample_group> sweeps;
+    if (isempty(current_sweep)) {
+        vl_error("error: pulse has begun but current_sweep is empty.");
+        return;
+    }
 
-    // Process all samples
-    for (unsigned i = 0; i < D.size(); i++) {
-
-        vive_headset_lighthouse_pulse2 sample = D[i];
-        if (sample.length < 2000) {
-
-            // sweep sample
-            if (!pulse_inds.empty()) {
-                // process the pulse set
-                vl_light_sample_group pulse;
-                std::tie(last_pulse_epoch, current_sweep, seq, pulse) = update_pulse_state(subset(D, pulse_inds), last_pulse_epoch, current_sweep, seq);
-
-                pulse_inds.clear();
-                pulse_range = {UINT32_MAX, 0};
-                if (!isempty(pulse)) {
-                    //vl_debug("pushing pulse 1");
-                    pulses.push_back(pulse);
-                } else {
-                    //vl_error("error: sweep has begun but pulse is empty.");
-                }
-            }
+    if (sweep_sink)
+        sweep_sink(sweep);
 
-            if (isempty(current_sweep)) {
-                // vl_warn("warning: current_sweep is empty.");
-                // do not know which sweep, so skip
-                continue;
-            }
+    // Like collect_readings(), which leaves out the cycle before the
+    // first x sweep of A or B.
+    if (!frame_sink || sweep.seq < 1)
+        return;
 
-            // accumulate sweep samples for a single sweep
-            sweep_inds.push_back(i);
-        } else {
-            // pulse sample
-            if (!sweep_inds.empty()) {
-                // store one sweep
-
-                vl_light_sample_group sweep = {
-                    /*channel*/ current_sweep.channel,
-                    /*sweep*/ current_sweep.sweep,
-                    /*epoch*/ current_sweep.epoch,
-                    /*skip*/ 0,
-                    /*seq*/ seq,
-                    /*samples*/ subset(D, sweep_inds)
-                };
-
-                sweep_inds.clear();
-
-                if (!isempty(current_sweep)) {
-                    sweeps.push_back(sweep);
-                } else {
-                    vl_error("error: pulse has begun but current_sweep is empty.");
-                }
-            }
+    if (sweep.sweep == 'H') {
+        x_sweeps[sweep.channel] = std::move(sweep);
+        return;
+    }
 
-            // A pulse belongs to the existing set if it overlaps
-            // the whole set seen so far.
-            if (pulse_inds.empty() || (sample.timestamp <= pulse_range.second && sample.timestamp + sample.length >= pulse_range.first)) {
-                // compute the time span of pulses seen so far
-                pulse_range = {
-                    std::min(pulse_range.first, sample.timestamp),
-                    std::max(pulse_range.second, sample.timestamp + sample.length)
-                };
-
-                // accumulate a single pulse set
-                pulse_inds.push_back(i);
-            } else {
-                // Otherwise, a new pulse set start immediately after
-                // the previous one without any sweep samples in between.
-
-                if (sample.timestamp + sample.length < pulse_range.first)
-                    vl_warn("Out of order pulse at index %d", i);
-
-                // process the pulse set
-                vl_light_sample_group pulse;
-                std::tie(last_pulse_epoch, current_sweep, seq, pulse) = update_pulse_state(subset(D, pulse_inds), last_pulse_epoch, current_sweep, seq);
-
-                pulse_inds.clear();
-                pulse_range = {UINT_MAX, 0};
-                if (!isempty(pulse))
-                    pulses.push_back(pulse);
+    auto x_sweep = x_sweeps.find(sweep.channel);
+    if (x_sweep == x_sweeps.end() || x_sweep->second.seq != sweep.seq)
+        return;
 
-            }
-        }
+    vl_light_frame frame;
+    if (vl_light_make_frame(sweep.seq, x_sweep->second, sweep, &frame))
+        frame_sink(sweep.channel, frame);
+    x_sweeps.erase(x_sweep);
+}
+
+void vl_light_classifier::classify(const vive_headset_lighthouse_pulse2& sample) {
+    if (sample.length < 2000) {
+        // sweep sample
+        if (!pulse_samples.empty())
+            end_pulse_set();
+
+        // do not know which sweep, so skip
+        if (isempty(current_sweep))
+            return;
+
+        // accumulate sweep samples for a single sweep
+        sweep_samples.push_back(sample);
+        return;
+    }
+
+    // pulse sample
+    if (!sweep_samples.empty())
+        end_sweep();
+
+    // A pulse belongs to the existing set if it overlaps
+    // the whole set seen so far.
+    if (pulse_samples.empty() || (sample.timestamp <= pulse_range.second && sample.timestamp + sample.length >= pulse_range.first)) {
+        // compute the time span of pulses seen so far
+        pulse_range = {
+            std::min(pulse_range.first, sample.timestamp),
+            std::max(pulse_range.second, sample.timestamp + sample.length)
+        };
+
+        // accumulate a single pulse set
+        pulse_samples.push_back(sample);
+    } else {
+        // Otherwise, a new pulse set start immediately after
+        // the previous one without any sweep samples in between.
+
+        if (sample.timestamp + sample.length < pulse_range.first)
+            vl_debug("Out of order pulse at %u", sample.timestamp);
+
+        end_pulse_set();
+    }
+}
+
+void vl_light_classifier::push(const vive_headset_lighthouse_pulse2& sample) {
+    uint64_t time = clock.unwrap(sample.timestamp);
+
+    if (time < newest) {
+        reorder_stats.reordered++;
+        reorder_stats.max_ticks = std::max(reorder_stats.max_ticks, static_cast<uint32_t>(newest - time));
+    } else {
+        newest = time;
     }
 
+    if (buffer.full())
+        flush_one();
+    buffer.push(time, sample);
+}
+
+void vl_light_classifier::flush_one() {
+    uint64_t time = buffer.front_time();
+    vive_headset_lighthouse_pulse2 sample = buffer.pop();
+    if (has_out && time < last_out) {
+        reorder_stats.dropped++;
+        return;
+    }
+    last_out = time;
+    has_out = true;
+    classify(sample);
+}
+
+void vl_light_classifier::flush() {
+    while (!buffer.empty())
+        flush_one();
+}
+
+void vl_light_classifier::reset() {
+    buffer.clear();
+    clock.reset();
+    newest = 0;
+    last_out = 0;
+    has_out = false;
+
+    pulse_samples.clear();
+    pulse_range = {UINT32_MAX, 0};
+    sweep_samples.clear();
+    last_pulse_epoch = -1e6;
+    seq = 0;
+    current_sweep = vl_light_sample_group();
+    x_sweeps.clear();
+}
+
+std::tuple<std::vector<vl_light_sample_group>, std::vector<vl_light_sample_group>> process_lighthouse_samples(const vl_lighthouse_samples& unsorted, vl_ootx_decoders* ootx) {
+    std::vector<vl_light_sample_group> pulses;
+    std::vector<vl_light_sample_group> sweeps;
+
+    vl_light_classifier classifier;
+    if (ootx)
+        classifier.ootx = *ootx;
+    classifier.pulse_sink = [&pulses](const vl_light_sample_group& pulse) {
+        pulses.push_back(pulse);
+    };
+    classifier.sweep_sink = [&sweeps](const vl_light_sample_group& sweep) {
+        sweeps.push_back(sweep);
+    };
+
+    for (const vive_headset_lighthouse_pulse2& sample : unsorted)
+        classifier.push(sample);
+    classifier.flush();
+
+    const vl_light_reorder_stats& reorder_stats = classifier.reorder_stats;
+    if (reorder_stats.reordered > 0)
+        vl_debug("Reordered %u of %zu samples, up to %u ticks late, dropped %u",
+                 reorder_stats.reordered, unsorted.size(),
+                 reorder_stats.max_ticks, reorder_stats.dropped);
+
+    if (ootx)
+        *ootx = std::move(classifier.ootx);
+
     return std::tuple<std::vector<vl_light_sample_group>, std::vector<vl_light_sample_group>> (sweeps, pulses);
     // GCC 6
     //return {sweeps, pulses};
 }
 
-void print_readings(const std::map<unsigned, vl_angles>& readings) {
-    for (auto angles : readings) {
-        for (unsigned i = 0; i < angles.second.x.size(); i++ ) {
-            vl_info("sensor %u, x %u, y %u, t %u",
-                   angles.first,
-                   angles.second.x[i],
-                   angles.second.y[i],
-                   angles.second.t[i]);
-        }
-    }
+void print_readings(const vl_station_readings& readings) {
+    for (unsigned s = 0; s < VL_MAX_SENSORS; s++)
+        for (const vl_light_frame& frame : readings)
+            if (is_sensor_visible(frame, s))
+                vl_info("sensor %u, x %u, y %u, t %u",
+                        s, frame.x[s], frame.y[s], frame.t);
 }
 
-void write_readings_to_csv(const std::map<unsigned, vl_angles>& readings, const std::string& file_name) {
+void write_readings_to_csv(const vl_station_readings& readings, const std::string& file_name) {
     std::ofstream csv_file;
     csv_file.open (file_name);
 
     vl_info("Writing %s", file_name.c_str());
-    for (auto angles : readings)
-        for (unsigned i = 0; i < angles.second.x.size(); i++ )
-            csv_file << angles.first << ","
-                     << angles.second.x[i] << ","
-                     << angles.second.y[i] << ","
-                     << angles.second.t[i] << "\n";
+    for (unsigned s = 0; s < VL_MAX_SENSORS; s++)
+        for (const vl_light_frame& frame : readings)
+            if (is_sensor_visible(frame, s))
+                csv_file << s << ","
+                         << frame.x[s] << ","
+                         << frame.y[s] << ","
+                         << frame.t << "\n";
 
     csv_file.close();
 }
@@ -756,75 +904,17 @@ void vl_light_classify_samples(const vl_lighthouse_samples& raw_light_samples) {
     vl_info("Found %zu sweeps", sweeps.size());
     write_light_groups_to_file("Sweeps", "b_c_still.sweeps.cpp.txt", sweeps, print_sweep);
 
-    std::map<unsigned, vl_angles> R_B = collect_readings('B', sweeps);
-    std::map<unsigned, vl_angles> R_C = collect_readings('C', sweeps);
+    vl_station_readings R_B = collect_readings('B', sweeps);
+    vl_station_readings R_C = collect_readings('C', sweeps);
 
-    vl_info("Found %zu sensors with B angles", R_B.size());
+    vl_info("Found %u sensors with B angles", count_visible_sensors(R_B));
     // print_readings(R_B);
 
-    vl_info("Found %zu sensors with C angles", R_C.size());
+    vl_info("Found %u sensors with C angles", count_visible_sensors(R_C));
     // print_readings(R_C);
 
-    if (R_B.size() > 0)
+    if (!R_B.empty())
         write_readings_to_csv(R_B, "b_angles.csv");
-    if (R_C.size() > 0)
+    if (!R_C.empty())
         write_readings_to_csv(R_C, "c_angles.csv");
 }
-
-void dump_readings_to_csv(const std::string& file_name,
-                     const std::map<unsigned, vl_angles>& readings,
-                     const std::map<unsigned, cv::Point3f>& config_sensor_positions) {
-    cv::Mat rvec, tvec;
-
-    //bool useExtrinsicGuess=false;
-    //int flags=ITERATIVE;
-
-    std::vector<cv::Point3f> configSensors;
-    std::vector<cv::Point2f> foundSensors;
-
-    cv::Mat cameraMatrix = cv::Mat::eye(3, 3, CV_64F);
-    //cv::Mat distCoeffs = cv::Mat::zeros(3, 3, CV_64F);
-    cv::Mat distCoeffs;
-
-    unsigned sample_count = readings.begin()->second.x.size();
-
-    std::ofstream csv_file;
-    csv_file.open (file_name);
-
-    vl_info("Writing %u %s", sample_count, file_name.c_str());
-
-    for (unsigned i = 0; i < sample_count; i++) {
-
-        for (auto angles : readings) {
-           // for (unsigned i = 0; i < angles.second.x.size(); i++ )
-                foundSensors.push_back(cv::Point2f(angles.second.x[i], angles.second.y[i]));
-                configSensors.push_back(config_sensor_positions.at(angles.first));
-        }
-
-        if (!solvePnP(cv::Mat(configSensors), cv::Mat(foundSensors), cameraMatrix,
-                 distCoeffs, rvec, tvec))
-            vl_error("error: PnP returned 0.");
-
-        csv_file << tvec.at<double>(0) << ","
-                 << tvec.at<double>(1) << ","
-                 << tvec.at<double>(2) << "\n";
-
-    }
-
-    csv_file.close();
-}
-
-
-void dump_pnp_positions(vl_lighthouse_samples *raw_light_samples,
-             const std::map<unsigned, cv::Point3f>& config_sensor_positions) {
-    vl_lighthouse_samples sanitized_light_samples = filter_reports(*raw_light_samples, &is_sample_valid);
-    std::vector<vl_light_sample_group> pulses;
-    std::vector<vl_light_sample_group> sweeps;
-    std::tie(sweeps, pulses) = process_lighthouse_samples(sanitized_light_samples);
-    std::map<unsigned, vl_angles> R_B = collect_readings('B', sweeps);
-    std::map<unsigned, vl_angles> R_C = collect_readings('C', sweeps);
-
-    dump_readings_to_csv("b_positions.csv", R_B, config_sensor_positions);
-    dump_readings_to_csv("c_positions.csv", R_C, config_sensor_positions);
-
-}
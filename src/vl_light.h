@@ -3,8 +3,12 @@
 #include <functional>
 #include <vector>
 #include <string>
+#include <climits>
 #include <map>
-#include <opencv2/core/types.hpp>
+
+#include "vl_hid_reports.h"
+#include "vl_ootx.h"
+#include "vl_reorder.h"
 
 #define VL_ROTOR_RPS 60 // 60 rps
 #define VL_TICK_RATE 48e6 // 48 Mhz
@@ -19,6 +23,7 @@ struct vl_light_sample_group {
     char sweep; // rotor
     double epoch;
     int skip;
+    int data; // over-the-light data bit
     int seq;
     vl_lighthouse_samples samples;
 };
@@ -109,6 +114,17 @@ void subset(S, elms) {
 
 uint32_t ticks_sample_to_angle(const vive_headset_lighthouse_pulse2& sample, uint32_t epoch);
 
+// Convert angle ticks to radians
+//
+// rad = angle_ticks_to_rad(ticks)
+//
+//	ticks	angle ticks relative to the sweep epoch
+//
+//	rad	The sweep angle, 0 being the optical axis of the station,
+//		which the rotor passes a quarter rotation after the sync pulse.
+
+double angle_ticks_to_rad(uint32_t ticks);
+
 // Convert tick-delta to millimeters
 //
 // mm = ticks_to_mm(ticks, dist)
@@ -149,6 +165,8 @@ vl_light_sample_group process_pulse_set(const vl_lighthouse_samples& S, int64_t
 //			- sweep: 'H' or 'V'
 //			Can be empty due to detection errors.
 //	seq		scanning cycle sequence number
+//	ootx		Optional OOTX decoders, the data bit of every valid
+//			pulse is fed to the decoder of its channel.
 //
 // Outputs:
 //	out_pulse	Only set for valid non-skipped pulses. A struct
@@ -163,21 +181,43 @@ std::tuple<double, vl_light_sample_group, int, vl_light_sample_group> update_pul
         const vl_lighthouse_samples& pulse_samples,
         double last_pulse_epoch,
         vl_light_sample_group current_sweep,
-        int seq);
+        int seq,
+        vl_ootx_decoders* ootx = nullptr);
+
+#define VL_MAX_SENSORS 32
 
-struct vl_angles {
-    std::vector<uint32_t> x;
-    std::vector<uint32_t> y;
-    std::vector<uint32_t> t;
+// Readings of one scanning cycle of a single station
+//
+//	visible	bit s is set when sensor s was hit by both sweeps,
+//		x[s] and y[s] are only meaningful then.
+//	seq	scanning cycle sequence number, the same for both
+//		stations in mode B+C
+//	t	x sweep epoch
+//	x, y	angle ticks of the horizontal and vertical sweep
+struct vl_light_frame {
+    uint32_t visible;
+    int seq;
+    uint32_t t;
+    uint32_t x[VL_MAX_SENSORS];
+    uint32_t y[VL_MAX_SENSORS];
 };
 
+// All frames of one station, stored in one contiguous block.
+typedef std::vector<vl_light_frame> vl_station_readings;
+
+static inline bool is_sensor_visible(const vl_light_frame& frame, unsigned sensor_id) {
+    return frame.visible & (1u << sensor_id);
+}
+
+unsigned count_visible_sensors(const vl_station_readings& readings);
+
 
 int find_max_seq(const std::vector<vl_light_sample_group>& sweeps);
 std::vector<vl_light_sample_group> filter_sweeps(
         const std::vector<vl_light_sample_group>& sweeps, char ch, int seq, char rotor);
 int find_max_sendor_id(vl_lighthouse_samples samples);
 vl_lighthouse_samples filter_samples_by_sensor_id(const vl_lighthouse_samples& samples, int sensor_id);
-std::map<unsigned, vl_angles> collect_readings(char station, const std::vector<vl_light_sample_group>& sweeps);
+vl_station_readings collect_readings(char station, const std::vector<vl_light_sample_group>& sweeps);
 vl_lighthouse_samples filter_reports(const vl_lighthouse_samples& reports, const sample_filter& filter_fun);
 
 // Sanitize Vive light samples
@@ -193,6 +233,33 @@ vl_lighthouse_samples filter_reports(const vl_lighthouse_samples& reports, const
 
 bool is_sample_valid(const vive_headset_lighthouse_pulse2& s);
 
+// Restore the timestamp order of Vive light samples
+//
+// D = reorder_samples(S, window, stats)
+//
+//	S	Struct of samples, see load_dump().
+//	window	Number of samples held back to sort late arrivals in.
+//	stats	Optional, counts how often and how far samples were
+//		reordered.
+//
+//	D	The same samples sorted by timestamp. Samples that arrive
+//		more than window samples late cannot be put back in order
+//		and are dropped.
+//
+// Each sample costs O(log window).
+
+#define VL_LIGHT_REORDER_WINDOW 32
+
+struct vl_light_reorder_stats {
+    unsigned reordered = 0;
+    unsigned dropped = 0;
+    // largest distance of a reordered sample behind the newest one
+    uint32_t max_ticks = 0;
+};
+
+vl_lighthouse_samples reorder_samples(const vl_lighthouse_samples& S, size_t window,
+                                      vl_light_reorder_stats* stats = nullptr);
+
 // Process and classify Lighthouse samples
 //
 // [sweeps, pulses] = process_lighthouse_samples(D)
@@ -214,15 +281,76 @@ bool is_sample_valid(const vive_headset_lighthouse_pulse2& s);
 //		- samples: the subset of D with the samples indicating this pulse
 //
 // The struct D should have been sanitized first, see sanitize().
+// It does not need to be sorted, it is reordered like reorder_samples()
+// does, see vl_light_classifier.
+//
+// The over-the-light data bits are fed to ootx, if given, see
+// update_pulse_state().
 //
 // Only the meaningful pulses are returned, i.e. those with the bit skip=false.
 
 
 vl_lighthouse_samples subset(vl_lighthouse_samples D, std::vector<int> indices);
 bool isempty(const vl_light_sample_group& samples);
-std::tuple<std::vector<vl_light_sample_group>, std::vector<vl_light_sample_group>> process_lighthouse_samples(const vl_lighthouse_samples& D);
-void print_readings(const std::map<unsigned, vl_angles>& readings);
-void write_readings_to_csv(const std::map<unsigned, vl_angles>& readings, const std::string& file_name);
+std::tuple<std::vector<vl_light_sample_group>, std::vector<vl_light_sample_group>> process_lighthouse_samples(const vl_lighthouse_samples& D, vl_ootx_decoders* ootx = nullptr);
+
+// Frame of one scanning cycle from the x and y sweep of a station.
+// Returns false if no sensor was hit by both.
+bool vl_light_make_frame(int seq, const vl_light_sample_group& x_sweep,
+                         const vl_light_sample_group& y_sweep, vl_light_frame* frame);
+
+typedef std::function<void(const vl_light_sample_group&)> vl_light_group_sink;
+typedef std::function<void(char station, const vl_light_frame&)> vl_light_frame_sink;
+
+// Incremental process_lighthouse_samples()
+//
+// Samples are classified as they arrive, the state is kept between
+// calls, so a live stream costs the same per sample as a capture. The
+// sinks are optional: pulses and sweeps get every group as the offline
+// function returns them, frames every complete frame, as soon as the
+// y sweep of a station ended, like collect_readings() would put it.
+class vl_light_classifier {
+    vl_reorder_buffer<vive_headset_lighthouse_pulse2> buffer;
+    vl_tick_unwrapper clock;
+    uint64_t newest = 0;
+    uint64_t last_out = 0;
+    bool has_out = false;
+
+    vl_lighthouse_samples pulse_samples;
+    std::pair<uint32_t, uint32_t> pulse_range = { UINT32_MAX, 0 };
+    vl_lighthouse_samples sweep_samples;
+    double last_pulse_epoch = -1e6;
+    int seq = 0;
+    vl_light_sample_group current_sweep = vl_light_sample_group();
+    // last x sweep per station, for the frames
+    std::map<char, vl_light_sample_group> x_sweeps;
+
+    void flush_one();
+    void classify(const vive_headset_lighthouse_pulse2& sample);
+    void end_pulse_set();
+    void end_sweep();
+
+public:
+    vl_light_reorder_stats reorder_stats;
+    vl_ootx_decoders ootx;
+
+    vl_light_group_sink pulse_sink;
+    vl_light_group_sink sweep_sink;
+    vl_light_frame_sink frame_sink;
+
+    explicit vl_light_classifier(size_t reorder_window = VL_LIGHT_REORDER_WINDOW);
+
+    // Sanitized samples, see is_sample_valid().
+    void push(const vive_headset_lighthouse_pulse2& sample);
+    // Classify the samples still held back for reordering.
+    void flush();
+    // Start over, after a gap in the samples. The decoded OOTX data
+    // is kept.
+    void reset();
+};
+
+void print_readings(const vl_station_readings& readings);
+void write_readings_to_csv(const vl_station_readings& readings, const std::string& file_name);
 std::string epoch_to_string(double epoch);
 std::string light_house_samples_to_string(const vl_lighthouse_samples& samples);
 void print_pulse(char* buffer, const vl_light_sample_group& g, const std::string& samples, unsigned i);
@@ -237,8 +365,7 @@ void write_light_groups_to_file(const std::string& title,
                                 const std::vector<vl_light_sample_group>& pulses,
                                 const print_fun& fun);
 void vl_light_classify_samples(const vl_lighthouse_samples& raw_light_samples);
-void dump_readings_to_csv(const std::string& file_name,
-                     const std::map<unsigned, vl_angles>& readings,
-                     const std::map<unsigned, cv::Point3f>& config_sensor_positions);
-void dump_pnp_positions(vl_lighthouse_samples *raw_light_samples,
-             const std::map<unsigned, cv::Point3f>& config_sensor_positions);
+
+// Largest reprojection RMS of an accepted pose, in normalized sweep
+// coordinates.
+#define VL_LIGHT_MAX_REPROJECTION 0.01
@@ -26,43 +26,87 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
-#include <vector>
 
-static const std::vector<uint8_t> vive_magic_power_on = {
+#include "vl_enums.h"
+
+// Command packets, built at compile time. Sending one needs no
+// allocation, see hid_send_feature_report().
+
+#define VL_HMD_POWER_COMMAND_SIZE 64
+
+typedef std::array<uint8_t, VL_HMD_POWER_COMMAND_SIZE> vl_hmd_power_command;
+
+// Recorded from the vendor software, beyond the first 13 bytes the
+// packets hold what looks like stack garbage, sent as is.
+static constexpr vl_hmd_power_command vive_magic_power_on = {{
 	0x04, 0x78, 0x29, 0x38, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x01,
 	0xa8, 0x0d, 0x76, 0x00, 0x40, 0xfc, 0x01, 0x05, 0xfa, 0xec, 0xd1, 0x6d, 0x00,
 	0x00, 0x6c, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa8, 0x0d, 0x76, 0x00, 0x68, 0xfc,
 	0x01, 0x05, 0x2c, 0xb0, 0x2e, 0x65, 0x7a, 0x0d, 0x76, 0x00, 0x68, 0x54, 0x72,
 	0x00, 0x18, 0x54, 0x72, 0x00, 0x00, 0x6a, 0x72, 0x00, 0x00, 0x00, 0x00,
-};
+}};
 
-static const std::vector<uint8_t> vive_magic_power_off1 = {
+static constexpr vl_hmd_power_command vive_magic_power_off1 = {{
 	0x04, 0x78, 0x29, 0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
 	0x30, 0x05, 0x77, 0x00, 0x30, 0x05, 0x77, 0x00, 0x6c, 0x4d, 0x37, 0x65, 0x40,
 	0xf9, 0x33, 0x00, 0x04, 0xf8, 0xa3, 0x04, 0x04, 0x00, 0x00, 0x00, 0x70, 0xb0,
 	0x72, 0x00, 0xf4, 0xf7, 0xa3, 0x04, 0x7c, 0xf8, 0x33, 0x00, 0x0c, 0xf8, 0xa3,
 	0x04, 0x0a, 0x6e, 0x29, 0x65, 0x24, 0xf9, 0x33, 0x00, 0x00, 0x00, 0x00,
-};
+}};
 
-static const std::vector<uint8_t> vive_magic_power_off2 = {
+static constexpr vl_hmd_power_command vive_magic_power_off2 = {{
 	0x04, 0x78, 0x29, 0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
 	0x30, 0x05, 0x77, 0x00, 0xe4, 0xf7, 0x33, 0x00, 0xe4, 0xf7, 0x33, 0x00, 0x60,
 	0x6e, 0x72, 0x00, 0xb4, 0xf7, 0x33, 0x00, 0x04, 0x00, 0x00, 0x00, 0x70, 0xb0,
 	0x72, 0x00, 0x90, 0xf7, 0x33, 0x00, 0x7c, 0xf8, 0x33, 0x00, 0xd0, 0xf7, 0x33,
 	0x00, 0x3c, 0x68, 0x29, 0x65, 0x24, 0xf9, 0x33, 0x00, 0x00, 0x00, 0x00,
-};
+}};
 
-static const std::vector<uint8_t> vive_magic_enable_lighthouse = {
+static constexpr std::array<uint8_t, 1> vive_magic_enable_lighthouse = {{
 	0x04
+}};
+
+enum class vl_hmd_power_mode {
+    ON,
+    // the display goes off after both
+    OFF1,
+    OFF2,
 };
 
+static constexpr vl_hmd_power_command vl_hmd_power_command_for(vl_hmd_power_mode mode) {
+    return mode == vl_hmd_power_mode::ON ? vive_magic_power_on
+         : mode == vl_hmd_power_mode::OFF1 ? vive_magic_power_off1
+         : vive_magic_power_off2;
+}
 
-static const std::vector<uint8_t> vive_controller_haptic_pulse = {
-    255, 0x8f, 7, 0, 0, 0, 0, 0, 0, 0
-};
+#define VL_CONTROLLER_REPORT_ID 0xff
 
+typedef std::array<uint8_t, 10> vl_controller_haptic_command;
+typedef std::array<uint8_t, 7> vl_controller_power_off_command;
 
-static const std::vector<uint8_t> vive_controller_power_off = {
-    255, 0x9f, 4, 'o', 'f', 'f', '!'
-};
+static constexpr uint8_t vl_lo(uint16_t value) {
+    return value & 0xff;
+}
+
+static constexpr uint8_t vl_hi(uint16_t value) {
+    return value >> 8;
+}
+
+// A train of repeat + 1 pulses, on for high_us, which sets the
+// strength, and off for low_us.
+static constexpr vl_controller_haptic_command vl_controller_haptic(uint16_t high_us, uint16_t low_us, uint16_t repeat) {
+    return {{
+        VL_CONTROLLER_REPORT_ID, 0x8f, 7, 0,
+        vl_lo(high_us), vl_hi(high_us),
+        vl_lo(low_us), vl_hi(low_us),
+        vl_lo(repeat), vl_hi(repeat),
+    }};
+}
+
+static constexpr vl_controller_power_off_command vl_controller_power_off() {
+    return {{
+        VL_CONTROLLER_REPORT_ID, static_cast<uint8_t>(vl_controller_command::POWEROFF), 4, 'o', 'f', 'f', '!'
+    }};
+}
@@ -0,0 +1,79 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include "vl_mainboard.h"
+
+static void publish(const vl_mainboard_sink& sink, vl_mainboard_event_type type, uint16_t value) {
+    if (sink)
+        sink({ type, value });
+}
+
+void vl_mainboard_state::update(const vive_mainboard_status_report& pkt, const vl_mainboard_sink& sink) {
+    uint16_t proximity = __le16_to_cpu(pkt.proximity);
+
+    if (!worn && proximity >= VL_PROXIMITY_WORN) {
+        worn = true;
+        below = 0;
+        publish(sink, vl_mainboard_event_type::WORN, proximity);
+    } else if (worn && proximity < VL_PROXIMITY_REMOVED) {
+        if (++below >= VL_PROXIMITY_REMOVED_REPORTS) {
+            worn = false;
+            publish(sink, vl_mainboard_event_type::REMOVED, proximity);
+        }
+    } else {
+        below = 0;
+        if (!has_state)
+            publish(sink, worn ? vl_mainboard_event_type::WORN : vl_mainboard_event_type::REMOVED, proximity);
+    }
+
+    uint16_t new_lens_separation = __le16_to_cpu(pkt.lens_separation);
+    if (!has_state || new_lens_separation != lens_separation) {
+        lens_separation = new_lens_separation;
+        publish(sink, vl_mainboard_event_type::LENS_SEPARATION, lens_separation);
+    }
+
+    if (!has_state || (pkt.button != 0) != button) {
+        button = pkt.button != 0;
+        publish(sink, vl_mainboard_event_type::BUTTON, button);
+    }
+
+    uint16_t new_ipd = __le16_to_cpu(pkt.ipd);
+    if (!has_state || new_ipd != ipd) {
+        ipd = new_ipd;
+        publish(sink, vl_mainboard_event_type::IPD, ipd);
+    }
+
+    has_state = true;
+}
+
+const char* vl_mainboard_event_name(vl_mainboard_event_type type) {
+    switch (type) {
+    case vl_mainboard_event_type::WORN:
+        return "worn";
+    case vl_mainboard_event_type::REMOVED:
+        return "removed";
+    case vl_mainboard_event_type::BUTTON:
+        return "button";
+    case vl_mainboard_event_type::IPD:
+        return "ipd";
+    case vl_mainboard_event_type::LENS_SEPARATION:
+        return "lens separation";
+    }
+    return "unknown";
+}
@@ -0,0 +1,73 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "vl_hid_reports.h"
+
+// Raw proximity sensor counts. Being worn starts at once above
+// VL_PROXIMITY_WORN, it ends after VL_PROXIMITY_REMOVED_REPORTS
+// reports in a row below VL_PROXIMITY_REMOVED, so a strap moving on
+// the face does not toggle it.
+#define VL_PROXIMITY_WORN 300
+#define VL_PROXIMITY_REMOVED 150
+#define VL_PROXIMITY_REMOVED_REPORTS 10
+
+enum class vl_mainboard_event_type : uint8_t {
+    WORN,
+    REMOVED,
+    BUTTON,
+    IPD,
+    LENS_SEPARATION,
+};
+
+// A change of the headset controls, from a mainboard status report.
+//
+// value is 0 or 1 for BUTTON, in 1/100 mm for IPD, raw for
+// LENS_SEPARATION and the proximity count for WORN and REMOVED.
+struct vl_mainboard_event {
+    vl_mainboard_event_type type;
+    uint16_t value;
+};
+
+typedef std::function<void(const vl_mainboard_event&)> vl_mainboard_sink;
+
+// Turns mainboard status reports into events. All values are
+// published with the first report.
+class vl_mainboard_state {
+    bool has_state = false;
+    bool worn = false;
+    unsigned below = 0;
+    uint16_t lens_separation = 0;
+    uint16_t ipd = 0;
+    bool button = false;
+
+public:
+    void update(const vive_mainboard_status_report& pkt, const vl_mainboard_sink& sink);
+
+    bool is_worn() const { return worn; }
+    uint16_t get_ipd() const { return ipd; }
+    uint16_t get_lens_separation() const { return lens_separation; }
+    bool get_button() const { return button; }
+};
+
+const char* vl_mainboard_event_name(vl_mainboard_event_type type);
@@ -24,6 +24,10 @@
 #include <Eigen/Geometry>
 #include "vl_log.h"
 
+// Standard gravity, m/s^2. Also the scale of the accelerometer, see
+// vec3_from_accel() in vl_driver.cpp.
+#define VL_GRAVITY_EARTH 9.81
+
 static inline void print_eigen_quat(const char* label, const Eigen::Quaterniond& in) {
     vl_info("%s: %f %f %f %f", label, in.w(), in.x(), in.y(), in.z());
 }
@@ -34,3 +38,10 @@ static inline double get_angle_between_vectors(const Eigen::Vector3d& me, const
         return 0;
     return acos(me.dot(vec) / lengths);
 }
+
+// Heading about the world up axis Y, from where the device -Z axis
+// points. Meaningless when looking straight up or down.
+static inline double get_yaw(const Eigen::Quaterniond& q) {
+    Eigen::Vector3d forward = q * -Eigen::Vector3d::UnitZ();
+    return atan2(-forward.x(), -forward.z());
+}
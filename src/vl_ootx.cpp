@@ -0,0 +1,120 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <zlib.h>
+
+#include "vl_ootx.h"
+#include "vl_log.h"
+
+#define OOTX_PREAMBLE_ZEROS 17
+#define OOTX_MAX_PAYLOAD 64
+
+void vl_ootx_decoder::reset() {
+    synced = false;
+    bit_count = 0;
+    word = 0;
+    data.clear();
+}
+
+bool vl_ootx_decoder::decode_frame() {
+    unsigned length = data[0] | (data[1] << 8);
+    unsigned padded = length + (length & 1);
+    const uint8_t* payload = &data[2];
+    const uint8_t* crc_bytes = payload + padded;
+
+    uint32_t crc = crc_bytes[0] | (crc_bytes[1] << 8) |
+                   (crc_bytes[2] << 16) | ((uint32_t) crc_bytes[3] << 24);
+
+    if (crc32(0, payload, length) != crc) {
+        vl_debug("OOTX frame CRC mismatch.");
+        errors++;
+        return false;
+    }
+
+    if (length < 6) {
+        vl_debug("OOTX payload too short (%u bytes).", length);
+        errors++;
+        return false;
+    }
+
+    info.fw_version = payload[0] | (payload[1] << 8);
+    info.id = payload[2] | (payload[3] << 8) | (payload[4] << 16) | ((uint32_t) payload[5] << 24);
+
+    if (!has_info)
+        vl_info("Base station 0x%08x (firmware %u)", info.id, info.fw_version);
+
+    has_info = true;
+    frames++;
+
+    return true;
+}
+
+bool vl_ootx_decoder::push_bit(int bit) {
+    if (bit == 0) {
+        zeros++;
+    } else {
+        bool preamble = zeros >= OOTX_PREAMBLE_ZEROS;
+        zeros = 0;
+        if (preamble) {
+            // The one after the preamble is the first sync bit.
+            reset();
+            synced = true;
+            return false;
+        }
+    }
+
+    if (!synced)
+        return false;
+
+    if (bit_count == 16) {
+        if (bit != 1) {
+            vl_debug("OOTX sync bit missing.");
+            errors++;
+            reset();
+        }
+        bit_count = 0;
+        return false;
+    }
+
+    word = (word << 1) | (bit & 1);
+    bit_count++;
+
+    if (bit_count < 16)
+        return false;
+
+    data.push_back(word >> 8);
+    data.push_back(word & 0xff);
+    word = 0;
+
+    unsigned length = data[0] | (data[1] << 8);
+    if (length > OOTX_MAX_PAYLOAD) {
+        vl_debug("OOTX payload too long (%u bytes).", length);
+        errors++;
+        reset();
+        return false;
+    }
+
+    unsigned padded = length + (length & 1);
+    if (data.size() < 2 + padded + 4)
+        return false;
+
+    bool valid = decode_frame();
+    reset();
+    return valid;
+}
@@ -0,0 +1,64 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Base station information sent over-the-light
+//
+// Only the fields of the v6 payload needed to tell stations apart.
+struct vl_ootx_info {
+    uint16_t fw_version;
+    uint32_t id;
+};
+
+// Decoder for the OOTX frames sent one data bit per sync pulse
+//
+// A frame starts with 17 zeros followed by a one. After that a one is
+// inserted after every 16 data bits, so the preamble cannot appear in
+// the data. The data is a little endian 16 bit payload length, the
+// payload padded to an even length and a little endian CRC32 of the
+// payload.
+//
+// Reference: https://github.com/nairol/LighthouseRedox/blob/master/docs/Base%20Station.md
+class vl_ootx_decoder {
+    unsigned zeros = 0;
+    bool synced = false;
+    unsigned bit_count = 0;
+    uint16_t word = 0;
+    std::vector<uint8_t> data;
+
+    void reset();
+    bool decode_frame();
+
+public:
+    bool has_info = false;
+    vl_ootx_info info = {};
+    unsigned frames = 0;
+    unsigned errors = 0;
+
+    // Returns true when the bit completed a valid frame.
+    bool push_bit(int bit);
+};
+
+// One decoder per channel, 'A', 'B' or 'C'.
+typedef std::map<char, vl_ootx_decoder> vl_ootx_decoders;
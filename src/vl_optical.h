@@ -0,0 +1,97 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "vl_light.h"
+#include "vl_triangulate.h"
+#include "vl_visibility.h"
+
+struct vl_room_setup;
+
+// Optical tracking module
+//
+// The PnP solver needs OpenCV, which the IMU tracking and the heading
+// correction do without. It is built into a library of its own,
+// VL_OPTICAL_MODULE, that is only loaded once optical tracking is
+// used, see vl_optical_load(). Builds without OpenCV leave it out.
+
+#define VL_OPTICAL_MODULE "libvive-libre-optical.so"
+#define VL_OPTICAL_MODULE_ENTRY "vl_optical_module_get"
+// the module is of the same build, any change of the table raises it
+#define VL_OPTICAL_MODULE_VERSION 1
+
+// Optical tracking of one station
+//
+// While tracking, each frame is solved by PnP starting from the pose
+// of the previous frame. Without a prior pose, after a gap in the
+// frames or when the fit fails, the pose is acquired again with P3P,
+// see vl_p3p_acquire().
+//
+//	acquisitions	P3P acquisitions run
+//	tracked		frames solved from the previous pose
+//	lost		times tracking was lost
+//	first_pose_ticks	time from the first frame with enough
+//			sensors to the first pose, in device ticks
+//	reacquire_ticks	sum and maximum of the same time after
+//	max_reacquire_ticks	each loss, over reacquired losses
+//	acquire_us	processor time spent in acquisition
+//	culled		hits dropped because the sensor faced away from
+//			the station at the previous pose
+
+struct vl_light_tracking_stats {
+    unsigned acquisitions = 0;
+    unsigned tracked = 0;
+    unsigned lost = 0;
+    bool has_first_pose = false;
+    uint32_t first_pose_ticks = 0;
+    unsigned reacquired = 0;
+    uint64_t reacquire_ticks = 0;
+    uint32_t max_reacquire_ticks = 0;
+    uint64_t acquire_us = 0;
+    unsigned culled = 0;
+};
+
+struct vl_optical_module {
+    unsigned version;
+
+    // Place both base stations from a capture of mode B+C samples
+    //
+    // A cached setup is used if the base station serials were decoded
+    // and a setup for them exists, otherwise it is solved and cached.
+    bool (*room_setup)(const vl_lighthouse_samples& raw_light_samples,
+                       const vl_model_points& model,
+                       const vl_model_normals& normals,
+                       vl_room_setup* setup);
+
+    // Track a capture per station and write the positions to
+    // b_positions.csv and c_positions.csv, and triangulated from both
+    // to bc_positions.csv.
+    void (*dump_pnp_positions)(const vl_lighthouse_samples& raw_light_samples,
+                               const vl_model_points& model,
+                               const vl_model_normals& normals);
+};
+
+typedef const vl_optical_module* (*vl_optical_module_entry)();
+
+// Load the module on the first call, from next to this library or the
+// library path. nullptr if it is not installed or of another build.
+const vl_optical_module* vl_optical_load();
@@ -0,0 +1,70 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+
+#include <mutex>
+#include <string>
+
+#include <dlfcn.h>
+
+#include "vl_log.h"
+#include "vl_optical.h"
+
+// The directory of the library this is linked into, the module is
+// installed next to it.
+static std::string module_path() {
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&vl_optical_load), &info) && info.dli_fname) {
+        std::string path(info.dli_fname);
+        size_t slash = path.rfind('/');
+        if (slash != std::string::npos)
+            return path.substr(0, slash + 1) + VL_OPTICAL_MODULE;
+    }
+    return VL_OPTICAL_MODULE;
+}
+
+static const vl_optical_module* load_module() {
+    void* handle = dlopen(module_path().c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        handle = dlopen(VL_OPTICAL_MODULE, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        vl_error("Optical tracking is not available: %s", dlerror());
+        return nullptr;
+    }
+
+    vl_optical_module_entry entry = reinterpret_cast<vl_optical_module_entry>(dlsym(handle, VL_OPTICAL_MODULE_ENTRY));
+    const vl_optical_module* module = entry ? entry() : nullptr;
+    if (!module || module->version != VL_OPTICAL_MODULE_VERSION) {
+        vl_error("%s is not of this vive-libre build.", VL_OPTICAL_MODULE);
+        dlclose(handle);
+        return nullptr;
+    }
+
+    vl_debug("Loaded %s.", VL_OPTICAL_MODULE);
+
+    // stays loaded, the table points into it
+    return module;
+}
+
+const vl_optical_module* vl_optical_load() {
+    static std::once_flag once;
+    static const vl_optical_module* module = nullptr;
+    std::call_once(once, []() { module = load_module(); });
+    return module;
+}
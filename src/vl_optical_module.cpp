@@ -0,0 +1,404 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include "vl_light.h"
+#include "vl_log.h"
+#include "vl_optical.h"
+#include "vl_p3p.h"
+#include "vl_room_setup.h"
+#include "vl_triangulate.h"
+#include "vl_visibility.h"
+
+// PnP of a single station frame in normalized sweep coordinates. With
+// use_guess, model_to_station is the starting point of the iteration.
+static bool solve_frame_pnp(const vl_light_frame& frame,
+                            const std::vector<cv::Point3f>& config_sensor_positions,
+                            Eigen::Isometry3d* model_to_station,
+                            bool use_guess = false) {
+    std::vector<cv::Point3f> configSensors;
+    std::vector<cv::Point2f> foundSensors;
+    configSensors.reserve(VL_MAX_SENSORS);
+    foundSensors.reserve(VL_MAX_SENSORS);
+
+    for (unsigned s = 0; s < VL_MAX_SENSORS && s < config_sensor_positions.size(); s++) {
+        if (!is_sensor_visible(frame, s))
+            continue;
+        foundSensors.push_back(cv::Point2f(std::tan(angle_ticks_to_rad(frame.x[s])),
+                                           std::tan(angle_ticks_to_rad(frame.y[s]))));
+        configSensors.push_back(config_sensor_positions[s]);
+    }
+
+    // PnP needs at least 4 correspondences
+    if (foundSensors.size() < 4)
+        return false;
+
+    cv::Mat rvec, tvec;
+    cv::Mat rmat(3, 3, CV_64F);
+    cv::Mat cameraMatrix = cv::Mat::eye(3, 3, CV_64F);
+    cv::Mat distCoeffs;
+
+    if (use_guess) {
+        tvec = cv::Mat(3, 1, CV_64F);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                rmat.at<double>(i, j) = model_to_station->linear()(i, j);
+            tvec.at<double>(i) = model_to_station->translation()(i);
+        }
+        cv::Rodrigues(rmat, rvec);
+    }
+
+    if (!solvePnP(cv::Mat(configSensors), cv::Mat(foundSensors), cameraMatrix,
+                  distCoeffs, rvec, tvec, use_guess))
+        return false;
+
+    cv::Rodrigues(rvec, rmat);
+
+    model_to_station->setIdentity();
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            model_to_station->linear()(i, j) = rmat.at<double>(i, j);
+        model_to_station->translation()(i) = tvec.at<double>(i);
+    }
+
+    return true;
+}
+
+static std::vector<cv::Point3f> to_cv_points(const vl_model_points& model) {
+    std::vector<cv::Point3f> points;
+    points.reserve(model.size());
+    for (const Eigen::Vector3d& p : model)
+        points.push_back(cv::Point3f(p.x(), p.y(), p.z()));
+    return points;
+}
+
+// P3P acquisition refined by PnP, for frames without a prior pose.
+static bool acquire_frame_pose(const vl_light_frame& frame,
+                               const std::vector<cv::Point3f>& config_sensor_positions,
+                               const vl_model_points& model,
+                               const vl_model_normals& normals,
+                               Eigen::Isometry3d* model_to_station) {
+    return vl_p3p_acquire(frame, model, normals, model_to_station) &&
+           solve_frame_pnp(frame, config_sensor_positions, model_to_station, true) &&
+           vl_reprojection_rms(frame, model, *model_to_station) < VL_LIGHT_MAX_REPROJECTION;
+}
+
+typedef std::function<void(const vl_light_frame&, const Eigen::Isometry3d&)> frame_pose_fun;
+
+static void track_frames(const vl_station_readings& readings,
+                         const vl_model_points& model,
+                         const vl_model_normals& normals,
+                         const frame_pose_fun& fun,
+                         vl_light_tracking_stats* stats) {
+    std::vector<cv::Point3f> config_sensor_positions = to_cv_points(model);
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+
+    bool tracking = false;
+    // waiting for a pose since pending_since
+    bool pending = false;
+    uint32_t pending_since = 0;
+    int last_seq = 0;
+
+    auto lose = [&]() {
+        if (tracking)
+            stats->lost++;
+        tracking = false;
+    };
+
+    for (const vl_light_frame& reading : readings) {
+        if (tracking && reading.seq != last_seq + 1)
+            lose();
+
+        // Hits on sensors facing away from the station at the last pose
+        // are reflections, leave them out of the solution.
+        vl_light_frame frame = reading;
+        if (tracking) {
+            uint32_t facing = vl_visible_sensors(model, normals, pose);
+            stats->culled += __builtin_popcount(frame.visible & ~facing);
+            frame.visible &= facing;
+        }
+
+        if (__builtin_popcount(frame.visible) < 4) {
+            lose();
+            pending = false;
+            continue;
+        }
+
+        if (!tracking && !pending) {
+            pending = true;
+            pending_since = frame.t;
+        }
+
+        bool solved;
+        if (tracking) {
+            solved = solve_frame_pnp(frame, config_sensor_positions, &pose, true) &&
+                     vl_reprojection_rms(frame, model, pose) < VL_LIGHT_MAX_REPROJECTION;
+            if (solved)
+                stats->tracked++;
+        } else {
+            auto start = std::chrono::steady_clock::now();
+            solved = acquire_frame_pose(frame, config_sensor_positions, model, normals, &pose);
+            stats->acquire_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+            stats->acquisitions++;
+        }
+
+        if (!solved) {
+            if (tracking) {
+                lose();
+                pending = true;
+                pending_since = frame.t;
+            }
+            continue;
+        }
+
+        if (pending) {
+            uint32_t ticks = frame.t - pending_since;
+            if (!stats->has_first_pose) {
+                stats->has_first_pose = true;
+                stats->first_pose_ticks = ticks;
+            } else {
+                stats->reacquired++;
+                stats->reacquire_ticks += ticks;
+                stats->max_reacquire_ticks = std::max(stats->max_reacquire_ticks, ticks);
+            }
+            pending = false;
+        }
+
+        tracking = true;
+        last_seq = frame.seq;
+        fun(frame, pose);
+    }
+}
+
+static void print_tracking_stats(const std::string& title, const vl_light_tracking_stats& stats) {
+    const double ticks_per_ms = VL_TICK_RATE / 1000.0;
+
+    if (!stats.has_first_pose) {
+        vl_info("%s: no pose after %u acquisitions.", title.c_str(), stats.acquisitions);
+        return;
+    }
+
+    vl_info("%s: first pose after %.1fms, %u tracked frames, %u acquisitions (%.1fus each)",
+            title.c_str(), stats.first_pose_ticks / ticks_per_ms, stats.tracked,
+            stats.acquisitions, (double) stats.acquire_us / stats.acquisitions);
+
+    if (stats.reacquired > 0)
+        vl_info("%s: lost %u times, reacquired after %.1fms on average, %.1fms max",
+                title.c_str(), stats.lost,
+                stats.reacquire_ticks / ticks_per_ms / stats.reacquired,
+                stats.max_reacquire_ticks / ticks_per_ms);
+    else if (stats.lost > 0)
+        vl_info("%s: lost %u times, never reacquired", title.c_str(), stats.lost);
+
+    if (stats.culled > 0)
+        vl_info("%s: %u hits on sensors facing away culled", title.c_str(), stats.culled);
+}
+
+static void dump_readings_to_csv(const std::string& file_name,
+                                 const vl_station_readings& readings,
+                                 const vl_model_points& model,
+                                 const vl_model_normals& normals) {
+    std::ofstream csv_file;
+    csv_file.open (file_name);
+
+    vl_info("Writing %zu %s", readings.size(), file_name.c_str());
+
+    vl_light_tracking_stats stats;
+    track_frames(readings, model, normals,
+                 [&](const vl_light_frame&, const Eigen::Isometry3d& pose) {
+        csv_file << pose.translation().x() << ","
+                 << pose.translation().y() << ","
+                 << pose.translation().z() << "\n";
+    }, &stats);
+
+    csv_file.close();
+
+    print_tracking_stats(file_name, stats);
+}
+
+static bool solve_room_setup(const vl_station_readings& R_B,
+                             const vl_station_readings& R_C,
+                             const vl_ootx_decoders& ootx,
+                             const vl_model_points& model,
+                             const vl_model_normals& normals,
+                             vl_room_setup* setup) {
+    auto serial = [&](char channel) -> uint32_t {
+        auto decoder = ootx.find(channel);
+        return decoder != ootx.end() && decoder->second.has_info ? decoder->second.info.id : 0;
+    };
+
+    uint32_t serial_b = serial('B');
+    uint32_t serial_c = serial('C');
+    bool known = serial_b != 0 && serial_c != 0;
+
+    if (known) {
+        vl_room_setups cached = vl_room_setup_load();
+        const vl_room_setup* found = vl_room_setup_find(cached, serial_b, serial_c);
+        if (found) {
+            vl_info("Using cached room setup for stations 0x%08x and 0x%08x",
+                    serial_b, serial_c);
+            *setup = *found;
+            return true;
+        }
+    }
+
+    std::vector<cv::Point3f> config_sensor_positions = to_cv_points(model);
+    vl_frame_solver solver = [&](const vl_light_frame& frame, Eigen::Isometry3d* model_to_station) {
+        return acquire_frame_pose(frame, config_sensor_positions, model, normals, model_to_station);
+    };
+
+    if (!vl_room_setup_solve(R_B, R_C, model, solver, setup))
+        return false;
+
+    setup->serial_b = serial_b;
+    setup->serial_c = serial_c;
+
+    if (known)
+        vl_room_setup_save(*setup);
+    else
+        vl_warn("Base station serials not decoded yet, not caching the room setup.");
+
+    return true;
+}
+
+// Triangulate the sensors seen by both stations and fit the model to
+// them, in the room frame of the setup. Sensors facing away from a
+// station at the previous pose are not triangulated.
+static void dump_triangulated_positions(const std::string& file_name,
+                                        const vl_station_readings& R_B,
+                                        const vl_station_readings& R_C,
+                                        const vl_room_setup& setup,
+                                        const vl_model_points& model,
+                                        const vl_model_normals& normals) {
+    std::vector<cv::Point3f> config_sensor_positions = to_cv_points(model);
+
+    std::vector<vl_frame_pair> pairs = vl_pair_frames(R_B, R_C);
+
+    std::ofstream csv_file;
+    csv_file.open (file_name);
+
+    std::chrono::steady_clock::duration fit_time(0);
+    std::chrono::steady_clock::duration pnp_time(0);
+    Eigen::Isometry3d model_to_station;
+    Eigen::Isometry3d model_to_room;
+    bool have_pose = false;
+    unsigned culled = 0;
+
+    for (const vl_frame_pair& pair : pairs) {
+        auto start = std::chrono::steady_clock::now();
+        vl_light_frame frame_b = *pair.first;
+        vl_light_frame frame_c = *pair.second;
+        if (have_pose) {
+            uint32_t facing_b = vl_visible_sensors(model, normals, setup.pose_b.inverse() * model_to_room);
+            uint32_t facing_c = vl_visible_sensors(model, normals, setup.pose_c.inverse() * model_to_room);
+            culled += __builtin_popcount(frame_b.visible & ~facing_b) +
+                      __builtin_popcount(frame_c.visible & ~facing_c);
+            frame_b.visible &= facing_b;
+            frame_c.visible &= facing_c;
+        }
+
+        vl_triangulation points = vl_triangulate(frame_b, frame_c, setup.pose_b, setup.pose_c);
+        double rms;
+        bool fitted = vl_fit_rigid(model, points, &model_to_room, &rms);
+        have_pose = fitted;
+        fit_time += std::chrono::steady_clock::now() - start;
+
+        // For comparison only.
+        start = std::chrono::steady_clock::now();
+        solve_frame_pnp(*pair.first, config_sensor_positions, &model_to_station);
+        pnp_time += std::chrono::steady_clock::now() - start;
+
+        if (!fitted)
+            continue;
+
+        const Eigen::Vector3d& t = model_to_room.translation();
+        csv_file << t.x() << ","
+                 << t.y() << ","
+                 << t.z() << ","
+                 << rms << "\n";
+    }
+
+    csv_file.close();
+
+    if (pairs.empty())
+        return;
+
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    vl_info("Wrote %zu triangulated frames to %s, %.1fus per frame (PnP: %.1fus per station), %u hits culled",
+            pairs.size(), file_name.c_str(),
+            (double) duration_cast<microseconds>(fit_time).count() / pairs.size(),
+            (double) duration_cast<microseconds>(pnp_time).count() / pairs.size(),
+            culled);
+}
+
+static bool room_setup(const vl_lighthouse_samples& raw_light_samples,
+                       const vl_model_points& model,
+                       const vl_model_normals& normals,
+                       vl_room_setup* setup) {
+    vl_lighthouse_samples sanitized_light_samples = filter_reports(raw_light_samples, &is_sample_valid);
+    std::vector<vl_light_sample_group> pulses;
+    std::vector<vl_light_sample_group> sweeps;
+    vl_ootx_decoders ootx;
+    std::tie(sweeps, pulses) = process_lighthouse_samples(sanitized_light_samples, &ootx);
+    vl_station_readings R_B = collect_readings('B', sweeps);
+    vl_station_readings R_C = collect_readings('C', sweeps);
+
+    return solve_room_setup(R_B, R_C, ootx, model, normals, setup);
+}
+
+static void dump_pnp_positions(const vl_lighthouse_samples& raw_light_samples,
+                               const vl_model_points& model,
+                               const vl_model_normals& normals) {
+    vl_lighthouse_samples sanitized_light_samples = filter_reports(raw_light_samples, &is_sample_valid);
+    std::vector<vl_light_sample_group> pulses;
+    std::vector<vl_light_sample_group> sweeps;
+    vl_ootx_decoders ootx;
+    std::tie(sweeps, pulses) = process_lighthouse_samples(sanitized_light_samples, &ootx);
+    vl_station_readings R_B = collect_readings('B', sweeps);
+    vl_station_readings R_C = collect_readings('C', sweeps);
+
+    dump_readings_to_csv("b_positions.csv", R_B, model, normals);
+    dump_readings_to_csv("c_positions.csv", R_C, model, normals);
+
+    vl_room_setup setup;
+    if (solve_room_setup(R_B, R_C, ootx, model, normals, &setup))
+        dump_triangulated_positions("bc_positions.csv", R_B, R_C, setup, model, normals);
+}
+
+static const vl_optical_module module = {
+    VL_OPTICAL_MODULE_VERSION,
+    room_setup,
+    dump_pnp_positions,
+};
+
+extern "C" const vl_optical_module* vl_optical_module_get() {
+    return &module;
+}
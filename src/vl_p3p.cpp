@@ -0,0 +1,250 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include <Eigen/Eigenvalues>
+
+#include "vl_p3p.h"
+#include "vl_parallel.h"
+
+// Upper bound on the triples tried per frame.
+#define P3P_MAX_TRIPLES 120
+
+// Triples spanning less than this area in m^2 are close to collinear.
+#define P3P_MIN_TRIANGLE_AREA 1e-4
+
+// Reprojection error of sensors behind or facing away from the station.
+#define P3P_BEHIND_ERROR 1.0
+
+// Real roots of a4 x^4 + a3 x^3 + a2 x^2 + a1 x + a0 from the companion
+// matrix, polished with a few Newton steps.
+static int solve_quartic(const double a[5], double roots[4]) {
+    if (std::abs(a[4]) < 1e-12)
+        return 0;
+
+    Eigen::Matrix4d companion = Eigen::Matrix4d::Zero();
+    companion.diagonal(-1).setOnes();
+    for (int i = 0; i < 4; i++)
+        companion(i, 3) = -a[i] / a[4];
+
+    Eigen::EigenSolver<Eigen::Matrix4d> solver(companion, false);
+    const Eigen::Vector4cd& values = solver.eigenvalues();
+
+    int count = 0;
+    for (int i = 0; i < 4; i++) {
+        if (std::abs(values(i).imag()) > 1e-6 * (1.0 + std::abs(values(i).real())))
+            continue;
+
+        double x = values(i).real();
+        for (int step = 0; step < 2; step++) {
+            double f = (((a[4] * x + a[3]) * x + a[2]) * x + a[1]) * x + a[0];
+            double df = ((4 * a[4] * x + 3 * a[3]) * x + 2 * a[2]) * x + a[1];
+            if (std::abs(df) < 1e-12)
+                break;
+            x -= f / df;
+        }
+        roots[count++] = x;
+    }
+
+    return count;
+}
+
+// Follows the notation of Haralick et al., "Review and Analysis of
+// Solutions of the Three Point Perspective Pose Estimation Problem".
+int vl_p3p(const Eigen::Matrix3d& points, const Eigen::Matrix3d& rays, vl_p3p_poses* poses) {
+    const Eigen::Vector3d p1 = points.col(0), p2 = points.col(1), p3 = points.col(2);
+
+    double a2 = (p2 - p3).squaredNorm();
+    double b2 = (p1 - p3).squaredNorm();
+    double c2 = (p1 - p2).squaredNorm();
+    if (b2 < 1e-12)
+        return 0;
+
+    double cos_alpha = rays.col(1).dot(rays.col(2));
+    double cos_beta = rays.col(0).dot(rays.col(2));
+    double cos_gamma = rays.col(0).dot(rays.col(1));
+
+    double amc = (a2 - c2) / b2;
+    double apc = (a2 + c2) / b2;
+    double bmc = (b2 - c2) / b2;
+    double bma = (b2 - a2) / b2;
+
+    double A[5];
+    A[4] = (amc - 1) * (amc - 1) - 4 * c2 / b2 * cos_alpha * cos_alpha;
+    A[3] = 4 * (amc * (1 - amc) * cos_beta
+                - (1 - apc) * cos_alpha * cos_gamma
+                + 2 * c2 / b2 * cos_alpha * cos_alpha * cos_beta);
+    A[2] = 2 * (amc * amc - 1
+                + 2 * amc * amc * cos_beta * cos_beta
+                + 2 * bmc * cos_alpha * cos_alpha
+                - 4 * apc * cos_alpha * cos_beta * cos_gamma
+                + 2 * bma * cos_gamma * cos_gamma);
+    A[1] = 4 * (-amc * (1 + amc) * cos_beta
+                + 2 * a2 / b2 * cos_gamma * cos_gamma * cos_beta
+                - (1 - apc) * cos_alpha * cos_gamma);
+    A[0] = (1 + amc) * (1 + amc) - 4 * a2 / b2 * cos_gamma * cos_gamma;
+
+    double roots[4];
+    int n = solve_quartic(A, roots);
+
+    int found = 0;
+    for (int i = 0; i < n; i++) {
+        double v = roots[i];
+        if (v <= 0)
+            continue;
+
+        // distances along the rays, s2 = u s1 and s3 = v s1
+        double denom = 2 * (cos_gamma - v * cos_alpha);
+        if (std::abs(denom) < 1e-12)
+            continue;
+        double u = ((amc - 1) * v * v - 2 * amc * cos_beta * v + 1 + amc) / denom;
+        if (u <= 0)
+            continue;
+
+        double s1_sq = c2 / (1 + u * u - 2 * u * cos_gamma);
+        if (!(s1_sq > 0))
+            continue;
+        double s1 = std::sqrt(s1_sq);
+
+        Eigen::Matrix3d station_points;
+        station_points.col(0) = s1 * rays.col(0);
+        station_points.col(1) = u * s1 * rays.col(1);
+        station_points.col(2) = v * s1 * rays.col(2);
+
+        Eigen::Isometry3d pose;
+        pose.matrix() = Eigen::umeyama(points, station_points, false);
+        poses->push_back(pose);
+        found++;
+    }
+
+    return found;
+}
+
+double vl_reprojection_rms(const vl_light_frame& frame,
+                           const vl_model_points& model,
+                           const Eigen::Isometry3d& model_to_station,
+                           uint32_t facing) {
+    double sum = 0;
+    unsigned n = 0;
+
+    for (unsigned s = 0; s < VL_MAX_SENSORS && s < model.size(); s++) {
+        if (!is_sensor_visible(frame, s))
+            continue;
+
+        Eigen::Vector3d p = model_to_station * model[s];
+        n++;
+
+        if (p.z() <= 0 || !(facing & (1u << s))) {
+            sum += P3P_BEHIND_ERROR;
+            continue;
+        }
+
+        double dx = p.x() / p.z() - std::tan(angle_ticks_to_rad(frame.x[s]));
+        double dy = p.y() / p.z() - std::tan(angle_ticks_to_rad(frame.y[s]));
+        sum += dx * dx + dy * dy;
+    }
+
+    return n ? std::sqrt(sum / n) : std::numeric_limits<double>::infinity();
+}
+
+bool vl_p3p_acquire(const vl_light_frame& frame,
+                    const vl_model_points& model,
+                    const vl_model_normals& normals,
+                    Eigen::Isometry3d* model_to_station,
+                    double* rms) {
+    std::vector<unsigned> sensors;
+    for (unsigned s = 0; s < VL_MAX_SENSORS && s < model.size(); s++)
+        if (is_sensor_visible(frame, s))
+            sensors.push_back(s);
+
+    // The fourth sensor picks among the up to four P3P solutions.
+    if (sensors.size() < 4)
+        return false;
+
+    std::vector<std::array<unsigned, 3>> triples;
+    for (size_t i = 0; i < sensors.size(); i++) {
+        for (size_t j = i + 1; j < sensors.size(); j++) {
+            for (size_t k = j + 1; k < sensors.size(); k++) {
+                const Eigen::Vector3d& p1 = model[sensors[i]];
+                double area = 0.5 * (model[sensors[j]] - p1).cross(model[sensors[k]] - p1).norm();
+                if (area >= P3P_MIN_TRIANGLE_AREA)
+                    triples.push_back({{ sensors[i], sensors[j], sensors[k] }});
+            }
+        }
+    }
+
+    if (triples.empty())
+        return false;
+
+    // Spread the tried triples evenly over all of them.
+    size_t count = std::min<size_t>(triples.size(), P3P_MAX_TRIPLES);
+    double stride = (double) triples.size() / count;
+
+    Eigen::Isometry3d best_pose;
+    double best_rms = std::numeric_limits<double>::infinity();
+    std::mutex best_mutex;
+
+    vl_parallel_for(count, [&](size_t begin, size_t end) {
+        Eigen::Isometry3d local_pose;
+        double local_rms = std::numeric_limits<double>::infinity();
+        vl_p3p_poses poses;
+
+        for (size_t t = begin; t < end; t++) {
+            const std::array<unsigned, 3>& triple = triples[(size_t) (t * stride)];
+
+            Eigen::Matrix3d points, rays;
+            for (int c = 0; c < 3; c++) {
+                unsigned s = triple[c];
+                points.col(c) = model[s];
+                rays.col(c) = vl_sweep_ray(frame.x[s], frame.y[s]);
+            }
+
+            poses.clear();
+            vl_p3p(points, rays, &poses);
+
+            for (const Eigen::Isometry3d& pose : poses) {
+                uint32_t facing = vl_visible_sensors(model, normals, pose);
+                double error = vl_reprojection_rms(frame, model, pose, facing);
+                if (error < local_rms) {
+                    local_rms = error;
+                    local_pose = pose;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(best_mutex);
+        if (local_rms < best_rms) {
+            best_rms = local_rms;
+            best_pose = local_pose;
+        }
+    });
+
+    if (!std::isfinite(best_rms))
+        return false;
+
+    *model_to_station = best_pose;
+    if (rms)
+        *rms = best_rms;
+
+    return true;
+}
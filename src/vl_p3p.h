@@ -0,0 +1,66 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include "vl_hid_reports.h"
+#include "vl_light.h"
+#include "vl_triangulate.h"
+#include "vl_visibility.h"
+
+typedef std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>> vl_p3p_poses;
+
+// Closed form perspective-three-point pose (Grunert)
+//
+//	points	model points, one per column
+//	rays	unit rays from the station to the same points, in
+//		station coordinates
+//
+// Appends the up to four model to station transforms that place the
+// points on the rays. Returns the number of solutions added.
+int vl_p3p(const Eigen::Matrix3d& points, const Eigen::Matrix3d& rays, vl_p3p_poses* poses);
+
+// Root mean square reprojection error of all visible sensors of a
+// frame, in normalized sweep coordinates (tangent of the angle).
+// Sensors behind the station or missing from facing, see
+// vl_visible_sensors(), count as a large error.
+double vl_reprojection_rms(const vl_light_frame& frame,
+                           const vl_model_points& model,
+                           const Eigen::Isometry3d& model_to_station,
+                           uint32_t facing = 0xffffffff);
+
+// Acquire a pose from a single frame without a prior
+//
+// Runs vl_p3p() on sensor triples of the frame, spread over the
+// hardware threads, and keeps the candidate with the smallest
+// reprojection error over all visible sensors. With normals, poses
+// that turn seen sensors away from the station are penalized. The
+// result is meant as the initial guess of an iterative solver.
+// Returns false if fewer than 4 sensors are visible or no triple could
+// be solved.
+bool vl_p3p_acquire(const vl_light_frame& frame,
+                    const vl_model_points& model,
+                    const vl_model_normals& normals,
+                    Eigen::Isometry3d* model_to_station,
+                    double* rms = nullptr);
@@ -0,0 +1,66 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Set on the threads of a vl_parallel_for() and within a
+// vl_parallel_serial. Not static, so all translation units share it.
+inline bool& vl_parallel_serial_here() {
+    static thread_local bool serial = false;
+    return serial;
+}
+
+// While in scope, vl_parallel_for() runs serially on this thread. For
+// threads that must not wait on new ones, like the USB event thread.
+class vl_parallel_serial {
+    bool previous;
+
+public:
+    vl_parallel_serial() : previous(vl_parallel_serial_here()) { vl_parallel_serial_here() = true; }
+    ~vl_parallel_serial() { vl_parallel_serial_here() = previous; }
+};
+
+// Split [0, n) into one contiguous chunk per hardware thread and run
+// fun(begin, end) on each, returning once all chunks are done.
+//
+// Called from within another vl_parallel_for(), e.g. vl_p3p_acquire()
+// from vl_room_setup_solve(), it runs serially on the calling thread,
+// the outer loop already uses all cores.
+inline void vl_parallel_for(size_t n, const std::function<void(size_t, size_t)>& fun) {
+    size_t workers = std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+    if (workers <= 1 || vl_parallel_serial_here()) {
+        fun(0, n);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    size_t chunk = (n + workers - 1) / workers;
+    for (size_t begin = 0; begin < n; begin += chunk)
+        threads.emplace_back([&fun](size_t begin, size_t end) {
+            vl_parallel_serial_here() = true;
+            fun(begin, end);
+        }, begin, std::min(n, begin + chunk));
+    for (std::thread& thread : threads)
+        thread.join();
+}
@@ -0,0 +1,274 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "vl_log.h"
+#include "vl_pose_export.h"
+
+static_assert(sizeof(vl_pose_shm) == 192, "the layout is part of the ABI");
+static_assert(offsetof(vl_pose_shm, seq) == 64, "seq starts the second cache line");
+
+vl_pose_export::~vl_pose_export() {
+    if (thread.joinable()) {
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) == sizeof(one))
+            thread.join();
+        else
+            thread.detach();
+    }
+
+    for (const reader& r : readers) {
+        close(r.event_fd);
+        close(r.connection);
+    }
+    if (listen_fd >= 0)
+        close(listen_fd);
+    if (stop_fd >= 0)
+        close(stop_fd);
+
+    if (shm) {
+        munmap(shm, sizeof(vl_pose_shm));
+        // mapped readers keep their view
+        shm_unlink(name.c_str());
+    }
+}
+
+// The socket is bound before the segment is touched, so it also keeps
+// a second writer away. Abstract sockets go away with the process.
+bool vl_pose_export::start_listening() {
+    sockaddr_un addr;
+    socklen_t length = vl_pose_shm_address(name.c_str(), &addr);
+    if (length == 0) {
+        vl_error("Shared memory name %s is too long.", name.c_str());
+        return false;
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, (const sockaddr*) &addr, length) != 0 ||
+            ::listen(listen_fd, 4) != 0) {
+        if (errno == EADDRINUSE)
+            vl_error("Poses are already exported to %s by another process.", name.c_str());
+        else
+            vl_error("Failed to listen for pose readers: %s", strerror(errno));
+        return false;
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) {
+        vl_error("Failed to create an eventfd: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool vl_pose_export::open(const std::string& shm_name) {
+    if (shm)
+        return true;
+
+    name = shm_name;
+    if (!start_listening())
+        return false;
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        vl_error("Failed to create shared memory %s: %s", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, sizeof(vl_pose_shm)) != 0) {
+        vl_error("Failed to size shared memory %s: %s", name.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, sizeof(vl_pose_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        vl_error("Failed to map shared memory %s: %s", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    // A segment left behind by an earlier run starts over.
+    vl_pose_shm* segment = static_cast<vl_pose_shm*>(map);
+    memset(segment, 0, sizeof(vl_pose_shm));
+    segment->version = VL_POSE_SHM_VERSION;
+    segment->size = sizeof(vl_pose_shm);
+    segment->writer_pid = getpid();
+    // readers check the magic first
+    __atomic_store_n(&segment->magic, VL_POSE_SHM_MAGIC, __ATOMIC_RELEASE);
+    shm = segment;
+
+    thread = std::thread(&vl_pose_export::run, this);
+    vl_info("Exporting poses to shared memory %s.", name.c_str());
+
+    return true;
+}
+
+// Hand a new eventfd to a reader of the same user.
+void vl_pose_export::add_reader(int connection) {
+    ucred cred;
+    socklen_t cred_size = sizeof(cred);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &cred, &cred_size) != 0 || cred.uid != getuid()) {
+        vl_warn("Refused a pose reader of another user.");
+        close(connection);
+        return;
+    }
+
+    if (readers.size() >= VL_POSE_EXPORT_MAX_READERS) {
+        vl_warn("Refused pose reader %d, already %d readers.", cred.pid, VL_POSE_EXPORT_MAX_READERS);
+        close(connection);
+        return;
+    }
+
+    int event_fd = eventfd(0, EFD_CLOEXEC);
+    if (event_fd < 0) {
+        vl_warn("Failed to create an eventfd: %s", strerror(errno));
+        close(connection);
+        return;
+    }
+
+    char byte = 0;
+    iovec iov = { &byte, 1 };
+    union {
+        cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &event_fd, sizeof(int));
+
+    if (sendmsg(connection, &msg, MSG_NOSIGNAL) != 1) {
+        vl_warn("Failed to send the eventfd to pose reader %d: %s", cred.pid, strerror(errno));
+        close(event_fd);
+        close(connection);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(readers_mutex);
+    readers.push_back({ connection, event_fd });
+    vl_debug("Pose reader %d connected.", cred.pid);
+}
+
+void vl_pose_export::remove_reader(int connection) {
+    std::lock_guard<std::mutex> lock(readers_mutex);
+    auto it = std::find_if(readers.begin(), readers.end(), [connection](const reader& r) {
+        return r.connection == connection;
+    });
+    if (it == readers.end())
+        return;
+    close(it->event_fd);
+    close(it->connection);
+    readers.erase(it);
+}
+
+// Only this thread changes the readers, publish() only reads them.
+void vl_pose_export::run() {
+    std::vector<pollfd> fds;
+    while (true) {
+        fds.clear();
+        fds.push_back({ stop_fd, POLLIN, 0 });
+        fds.push_back({ listen_fd, POLLIN, 0 });
+        for (const reader& r : readers)
+            fds.push_back({ r.connection, POLLIN, 0 });
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            vl_error("Polling the pose readers failed: %s", strerror(errno));
+            return;
+        }
+
+        if (fds[0].revents)
+            return;
+
+        // Readers never send anything, any event is the end.
+        for (size_t i = 2; i < fds.size(); i++)
+            if (fds[i].revents)
+                remove_reader(fds[i].fd);
+
+        if (fds[1].revents & POLLIN) {
+            int connection = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection >= 0)
+                add_reader(connection);
+        }
+    }
+}
+
+vl_pose_shm_sample vl_pose_sample(uint64_t device_ticks,
+                                  const Eigen::Quaterniond& orientation,
+                                  const Eigen::Vector3d& angular_velocity,
+                                  uint32_t flags) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    vl_pose_shm_sample sample = {};
+    sample.device_ticks = device_ticks;
+    sample.host_time_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    sample.orientation[0] = orientation.w();
+    sample.orientation[1] = orientation.x();
+    sample.orientation[2] = orientation.y();
+    sample.orientation[3] = orientation.z();
+    for (int i = 0; i < 3; i++)
+        sample.angular_velocity[i] = angular_velocity[i];
+    sample.flags = flags;
+
+    return sample;
+}
+
+void vl_pose_export::publish(const vl_pose_shm_sample& sample) {
+    if (!shm)
+        return;
+
+    // Odd while writing, see vl_pose_shm_read().
+    uint32_t seq = shm->seq;
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&shm->sample, &sample, sizeof(sample));
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+
+    // Blocking eventfds, a write only blocks once a reader is 2^64
+    // updates behind.
+    uint64_t one = 1;
+    std::lock_guard<std::mutex> lock(readers_mutex);
+    for (const reader& r : readers)
+        if (write(r.event_fd, &one, sizeof(one)) < 0)
+            vl_debug("eventfd write failed: %s", strerror(errno));
+}
@@ -0,0 +1,82 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include "vl_pose_shm.h"
+
+// Environment variable to enable the export in the plugin, set to 1 or
+// to a shared memory object name starting with a slash.
+#define VL_POSE_EXPORT_ENV "VIVE_LIBRE_POSE_SHM"
+
+// A fused pose, stamped with the host time of now.
+vl_pose_shm_sample vl_pose_sample(uint64_t device_ticks,
+                                  const Eigen::Quaterniond& orientation,
+                                  const Eigen::Vector3d& angular_velocity,
+                                  uint32_t flags);
+
+typedef std::function<void(const vl_pose_shm_sample&)> vl_pose_sink;
+
+// Readers with an eventfd at most, further connections are refused.
+#define VL_POSE_EXPORT_MAX_READERS 16
+
+// Writer side of vl_pose_shm.h
+//
+// Only one writer per segment, publish() is not thread safe. Readers
+// connect on a thread of its own, publish() only takes its lock to
+// notify them. The segment is unlinked again when destroyed.
+class vl_pose_export {
+    struct reader {
+        int connection;
+        int event_fd;
+    };
+
+    std::string name;
+    vl_pose_shm* shm = nullptr;
+
+    int listen_fd = -1;
+    int stop_fd = -1;
+    std::thread thread;
+    std::mutex readers_mutex;
+    std::vector<reader> readers;
+
+    bool start_listening();
+    void run();
+    void add_reader(int connection);
+    void remove_reader(int connection);
+
+public:
+    vl_pose_export() = default;
+    ~vl_pose_export();
+    vl_pose_export(const vl_pose_export&) = delete;
+    vl_pose_export& operator=(const vl_pose_export&) = delete;
+
+    bool open(const std::string& name = VL_POSE_SHM_NAME);
+    bool is_open() const { return shm != nullptr; }
+
+    void publish(const vl_pose_shm_sample& sample);
+};
@@ -0,0 +1,182 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+// Shared memory pose export, stable ABI
+//
+// This header is the whole interface for local consumers and is valid
+// C and C++. It does not depend on the rest of vive-libre.
+//
+// The driver creates the POSIX shared memory object VL_POSE_SHM_NAME
+// (or a name given to it), sized sizeof(struct vl_pose_shm), and
+// publishes every fused IMU report into it. A consumer maps it read
+// only:
+//
+//	int fd = shm_open(VL_POSE_SHM_NAME, O_RDONLY, 0);
+//	const struct vl_pose_shm* shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+//
+// and checks magic, version and that size is at least what it knows.
+// Later versions only append fields and raise version when the meaning
+// of an existing field changes.
+//
+// The sample is guarded by a seqlock: seq is odd while the writer is
+// in the middle of an update and advances by two per update. Readers
+// never block the writer and retry on a torn read, a bounded number of
+// times, see vl_pose_shm_read().
+//
+// Notification: the writer listens on the abstract unix socket of the
+// same name and answers every connection from the same user with an
+// eventfd of its own, see vl_pose_shm_eventfd(). The writer adds 1 to
+// it per update, so reading it returns the number of updates since the
+// last read; the segment always holds only the latest one. The eventfd
+// is dropped when the connection is closed.
+
+#pragma once
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define VL_POSE_SHM_NAME "/vive-libre-pose"
+#define VL_POSE_SHM_MAGIC 0x53504c56 // "VLPS"
+#define VL_POSE_SHM_VERSION 1
+
+// A read gives up after this many tries, the first few spin, the others
+// yield to let a preempted writer finish.
+#define VL_POSE_SHM_READ_RETRIES 1000
+#define VL_POSE_SHM_READ_SPINS 16
+
+// vl_pose_shm_sample.flags
+// past the fusion startup, the orientation is meaningful
+#define VL_POSE_SHM_STARTED (1u << 0)
+// the headset is at rest
+#define VL_POSE_SHM_STILL (1u << 1)
+
+struct vl_pose_shm_sample {
+    // device clock, 48 MHz ticks, unwrapped to 64 bit
+    uint64_t device_ticks;
+    // CLOCK_MONOTONIC of the host when the report was fused, in ns
+    uint64_t host_time_ns;
+    // headset to world rotation, w x y z
+    double orientation[4];
+    // bias corrected, in the headset frame, in rad/s
+    double angular_velocity[3];
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+struct vl_pose_shm {
+    // constant while the writer runs
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    int32_t writer_pid;
+    uint32_t reserved0[12];
+
+    // on its own cache line, written by the driver only
+    uint32_t seq;
+    uint32_t reserved1;
+    struct vl_pose_shm_sample sample;
+} __attribute__((aligned(64)));
+
+// Copy the latest sample. Returns 0 before the first update, 1 on
+// success. Lock free, retries while the writer is updating. Returns -1
+// if the writer stayed in the middle of an update for all
+// VL_POSE_SHM_READ_RETRIES tries, e.g. because it died there; check
+// writer_pid with kill(pid, 0) to tell.
+static inline int vl_pose_shm_read(const struct vl_pose_shm* shm, struct vl_pose_shm_sample* sample) {
+    uint32_t begin, end;
+    for (int tries = 0; tries < VL_POSE_SHM_READ_RETRIES; tries++) {
+        if (tries >= VL_POSE_SHM_READ_SPINS)
+            sched_yield();
+        begin = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (begin & 1)
+            continue;
+        memcpy(sample, (const void*) &shm->sample, sizeof(*sample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+        if (begin == end)
+            return begin != 0;
+    }
+    return -1;
+}
+
+// Abstract socket address of the segment name, returns its length or
+// 0 if the name is too long.
+static inline socklen_t vl_pose_shm_address(const char* name, struct sockaddr_un* addr) {
+    size_t length = strlen(name);
+    if (length + 1 > sizeof(addr->sun_path))
+        return 0;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // a leading zero byte is the abstract namespace
+    memcpy(addr->sun_path + 1, name, length);
+    return (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + length);
+}
+
+// Connect to the writer of the segment name and receive an eventfd.
+// Returns the eventfd, or -1. *connection is the socket to keep open
+// for as long as the eventfd is used, close both when done.
+static inline int vl_pose_shm_eventfd(const char* name, int* connection) {
+    struct sockaddr_un addr;
+    socklen_t length = vl_pose_shm_address(name, &addr);
+    if (length == 0)
+        return -1;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (const struct sockaddr*) &addr, length) != 0) {
+        close(sock);
+        return -1;
+    }
+
+    char byte;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    union {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    int fd = -1;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) == 1) {
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+    }
+
+    if (fd < 0) {
+        close(sock);
+        return -1;
+    }
+
+    *connection = sock;
+    return fd;
+}
@@ -0,0 +1,110 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// Extend a wrapping 32 bit tick counter to 64 bits.
+//
+// Consecutive values are assumed to be less than half a wrap (~44s at
+// 48 MHz) apart, which also makes slightly out of order values unwrap
+// to a time before the previous one instead of a full wrap ahead.
+class vl_tick_unwrapper {
+    uint64_t last = 0;
+    bool valid = false;
+
+public:
+    uint64_t unwrap(uint32_t ticks) {
+        if (!valid) {
+            last = ticks;
+            valid = true;
+            return last;
+        }
+        int32_t delta = static_cast<int32_t>(ticks - static_cast<uint32_t>(last));
+        last += delta;
+        return last;
+    }
+
+    void reset() {
+        valid = false;
+    }
+};
+
+// Bounded reorder buffer
+//
+// Holds at most `capacity` items in a binary min-heap keyed by a 64 bit
+// timestamp, so push() and pop() are O(log capacity) and items always
+// come out oldest first. The storage is reserved once up front.
+template <typename T>
+class vl_reorder_buffer {
+    struct entry {
+        uint64_t time;
+        T item;
+    };
+
+    static bool later(const entry& a, const entry& b) {
+        return a.time > b.time;
+    }
+
+    std::vector<entry> heap;
+    size_t capacity;
+
+public:
+    explicit vl_reorder_buffer(size_t capacity) : capacity(capacity) {
+        assert(capacity > 0);
+        heap.reserve(capacity);
+    }
+
+    bool empty() const { return heap.empty(); }
+    bool full() const { return heap.size() >= capacity; }
+    size_t size() const { return heap.size(); }
+
+    uint64_t front_time() const {
+        assert(!heap.empty());
+        return heap.front().time;
+    }
+
+    const T& front() const {
+        assert(!heap.empty());
+        return heap.front().item;
+    }
+
+    // The caller has to pop() first when the buffer is full.
+    void push(uint64_t time, const T& item) {
+        assert(!full());
+        heap.push_back({time, item});
+        std::push_heap(heap.begin(), heap.end(), later);
+    }
+
+    T pop() {
+        assert(!heap.empty());
+        std::pop_heap(heap.begin(), heap.end(), later);
+        T item = heap.back().item;
+        heap.pop_back();
+        return item;
+    }
+
+    void clear() {
+        heap.clear();
+    }
+};
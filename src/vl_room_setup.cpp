@@ -0,0 +1,357 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+#include <Eigen/Eigenvalues>
+#include <json/reader.h>
+#include <json/value.h>
+#include <json/writer.h>
+
+#include "vl_cache.h"
+#include "vl_log.h"
+#include "vl_parallel.h"
+#include "vl_room_setup.h"
+
+#define ROOM_SETUP_FILE "room-setups.json"
+#define ROOM_SETUP_VERSION 1
+
+// Reject single frame estimates this far from the average.
+#define MAX_OUTLIER_ANGLE (10.0 * M_PI / 180.0)
+#define MAX_OUTLIER_DISTANCE 0.2
+
+#define REFINE_ITERATIONS 10
+
+typedef std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>> pose_list;
+
+// Rotation average from the dominant eigenvector of the sum of
+// quaternion outer products (Markley et al.), median translation.
+static Eigen::Isometry3d average_poses(const pose_list& poses) {
+    Eigen::Matrix4d M = Eigen::Matrix4d::Zero();
+    std::vector<double> x, y, z;
+
+    for (const Eigen::Isometry3d& pose : poses) {
+        Eigen::Quaterniond q(pose.linear());
+        M += q.coeffs() * q.coeffs().transpose();
+        x.push_back(pose.translation().x());
+        y.push_back(pose.translation().y());
+        z.push_back(pose.translation().z());
+    }
+
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver(M);
+    Eigen::Quaterniond mean_rotation(Eigen::Vector4d(solver.eigenvectors().col(3)));
+
+    auto median = [](std::vector<double>& v) {
+        std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+        return v[v.size() / 2];
+    };
+
+    Eigen::Isometry3d mean = Eigen::Isometry3d::Identity();
+    mean.linear() = mean_rotation.normalized().toRotationMatrix();
+    mean.translation() = Eigen::Vector3d(median(x), median(y), median(z));
+    return mean;
+}
+
+// Stacked model fit residuals of all frame pairs for a pose of station C.
+class room_residuals {
+    const std::vector<vl_frame_pair>& pairs;
+    const vl_model_points& model;
+    std::vector<size_t> offsets;
+
+public:
+    size_t size = 0;
+
+    room_residuals(const std::vector<vl_frame_pair>& pairs, const vl_model_points& model)
+        : pairs(pairs), model(model) {
+        offsets.reserve(pairs.size());
+        for (const vl_frame_pair& pair : pairs) {
+            offsets.push_back(size);
+            uint32_t both = pair.first->visible & pair.second->visible;
+            if (model.size() < VL_MAX_SENSORS)
+                both &= (1u << model.size()) - 1;
+            unsigned n = __builtin_popcount(both);
+            if (n >= 3)
+                size += 3 * n;
+        }
+    }
+
+    void evaluate(const vl_station_pose& pose_c, Eigen::VectorXd* r) const {
+        r->setZero(size);
+        vl_station_pose pose_b = vl_station_pose::Identity();
+
+        vl_parallel_for(pairs.size(), [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; k++) {
+                size_t count = (k + 1 < offsets.size() ? offsets[k + 1] : size) - offsets[k];
+                if (count == 0)
+                    continue;
+
+                vl_triangulation tri = vl_triangulate(*pairs[k].first, *pairs[k].second, pose_b, pose_c);
+                Eigen::Isometry3d model_to_room;
+                if (3 * tri.sensors.size() != count || !vl_fit_rigid(model, tri, &model_to_room))
+                    continue;
+
+                Eigen::Matrix3Xd src(3, tri.sensors.size());
+                for (size_t i = 0; i < tri.sensors.size(); i++)
+                    src.col(i) = model[tri.sensors[i]];
+
+                Eigen::Matrix3Xd residual = (model_to_room * src) - tri.points;
+                r->segment(offsets[k], count) = Eigen::Map<Eigen::VectorXd>(residual.data(), count);
+            }
+        });
+    }
+};
+
+static vl_station_pose perturb(const vl_station_pose& pose, const Eigen::Matrix<double, 6, 1>& delta) {
+    Eigen::Isometry3d step = Eigen::Isometry3d::Identity();
+    Eigen::Vector3d omega = delta.head<3>();
+    if (omega.norm() > 0)
+        step.linear() = Eigen::AngleAxisd(omega.norm(), omega.normalized()).toRotationMatrix();
+    step.translation() = delta.tail<3>();
+    return pose * step;
+}
+
+// Levenberg-Marquardt with a numeric Jacobian over the 6 pose parameters.
+static vl_station_pose refine_pose(const room_residuals& residuals, vl_station_pose pose, double* rms) {
+    Eigen::VectorXd r, r_step;
+    residuals.evaluate(pose, &r);
+    double cost = r.squaredNorm();
+    double lambda = 1e-3;
+    const double h = 1e-6;
+
+    Eigen::MatrixXd J(residuals.size, 6);
+
+    for (int iteration = 0; iteration < REFINE_ITERATIONS; iteration++) {
+        for (int i = 0; i < 6; i++) {
+            Eigen::Matrix<double, 6, 1> delta = Eigen::Matrix<double, 6, 1>::Zero();
+            delta(i) = h;
+            residuals.evaluate(perturb(pose, delta), &r_step);
+            J.col(i) = (r_step - r) / h;
+        }
+
+        Eigen::Matrix<double, 6, 6> JtJ = J.transpose() * J;
+        Eigen::Matrix<double, 6, 1> Jtr = J.transpose() * r;
+
+        bool improved = false;
+        while (!improved && lambda < 1e6) {
+            Eigen::Matrix<double, 6, 6> A = JtJ;
+            A.diagonal() *= 1.0 + lambda;
+            Eigen::Matrix<double, 6, 1> delta = A.ldlt().solve(-Jtr);
+
+            vl_station_pose candidate = perturb(pose, delta);
+            residuals.evaluate(candidate, &r_step);
+            double candidate_cost = r_step.squaredNorm();
+
+            if (candidate_cost < cost) {
+                pose = candidate;
+                r = r_step;
+                cost = candidate_cost;
+                lambda /= 10;
+                improved = true;
+            } else {
+                lambda *= 10;
+            }
+        }
+
+        if (!improved)
+            break;
+    }
+
+    *rms = residuals.size ? std::sqrt(cost / (residuals.size / 3)) : 0;
+    return pose;
+}
+
+bool vl_room_setup_solve(const vl_station_readings& R_B,
+                         const vl_station_readings& R_C,
+                         const vl_model_points& model,
+                         const vl_frame_solver& solve_frame,
+                         vl_room_setup* setup) {
+    std::vector<vl_frame_pair> pairs = vl_pair_frames(R_B, R_C);
+
+    pose_list estimates(pairs.size());
+    std::vector<char> solved(pairs.size(), 0);
+
+    // One estimate of station C in the frame of station B per frame pair.
+    vl_parallel_for(pairs.size(), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            Eigen::Isometry3d model_to_b, model_to_c;
+            if (solve_frame(*pairs[k].first, &model_to_b) &&
+                    solve_frame(*pairs[k].second, &model_to_c)) {
+                estimates[k] = model_to_b * model_to_c.inverse();
+                solved[k] = 1;
+            }
+        }
+    });
+
+    pose_list valid;
+    for (size_t k = 0; k < pairs.size(); k++)
+        if (solved[k])
+            valid.push_back(estimates[k]);
+
+    if (valid.empty()) {
+        vl_warn("Room setup: no frame pair could be solved (%zu pairs).", pairs.size());
+        return false;
+    }
+
+    Eigen::Isometry3d initial = average_poses(valid);
+
+    pose_list inliers;
+    for (const Eigen::Isometry3d& pose : valid) {
+        Eigen::AngleAxisd error(initial.linear().transpose() * pose.linear());
+        double distance = (pose.translation() - initial.translation()).norm();
+        if (std::fabs(error.angle()) < MAX_OUTLIER_ANGLE && distance < MAX_OUTLIER_DISTANCE)
+            inliers.push_back(pose);
+    }
+
+    if (!inliers.empty())
+        initial = average_poses(inliers);
+
+    vl_info("Room setup: %zu of %zu frame pairs solved, %zu inliers.",
+            valid.size(), pairs.size(), inliers.size());
+
+    room_residuals residuals(pairs, model);
+
+    setup->pose_b = vl_station_pose::Identity();
+    setup->pose_c = refine_pose(residuals, initial, &setup->rms);
+    setup->frames = pairs.size();
+
+    vl_info("Room setup: station C at %f %f %f, rms %f m",
+            setup->pose_c.translation().x(),
+            setup->pose_c.translation().y(),
+            setup->pose_c.translation().z(),
+            setup->rms);
+
+    return true;
+}
+
+static Json::Value pose_to_json(const vl_station_pose& pose) {
+    Json::Value array(Json::arrayValue);
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            array.append(pose.matrix()(i, j));
+    return array;
+}
+
+static bool pose_from_json(const Json::Value& array, vl_station_pose* pose) {
+    if (!array.isArray() || array.size() != 16)
+        return false;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            pose->matrix()(i, j) = array[i * 4 + j].asDouble();
+    return true;
+}
+
+vl_room_setups vl_room_setup_load() {
+    vl_room_setups setups;
+
+    std::string path = vl_cache_path(ROOM_SETUP_FILE);
+    if (path.empty())
+        return setups;
+
+    std::ifstream file(path);
+    if (!file.good())
+        return setups;
+
+    Json::Value root;
+    Json::CharReaderBuilder rbuilder;
+    std::string errs;
+    if (!Json::parseFromStream(rbuilder, file, &root, &errs)) {
+        vl_warn("Failed to parse %s: %s", path.c_str(), errs.c_str());
+        return setups;
+    }
+
+    if (root.get("version", 0).asInt() != ROOM_SETUP_VERSION) {
+        vl_warn("Ignoring %s, unknown version.", path.c_str());
+        return setups;
+    }
+
+    for (const Json::Value& entry : root["setups"]) {
+        vl_room_setup setup;
+        setup.serial_b = entry.get("serial_b", 0).asUInt();
+        setup.serial_c = entry.get("serial_c", 0).asUInt();
+        setup.rms = entry.get("rms", 0.0).asDouble();
+        setup.frames = entry.get("frames", 0).asUInt();
+        if (!pose_from_json(entry["pose_b"], &setup.pose_b) ||
+                !pose_from_json(entry["pose_c"], &setup.pose_c)) {
+            vl_warn("Skipping broken room setup in %s.", path.c_str());
+            continue;
+        }
+        setups.push_back(setup);
+    }
+
+    vl_debug("Loaded %zu room setups from %s", setups.size(), path.c_str());
+
+    return setups;
+}
+
+bool vl_room_setup_save(const vl_room_setup& setup) {
+    std::string path = vl_cache_path(ROOM_SETUP_FILE);
+    if (path.empty()) {
+        vl_warn("No cache directory, not saving the room setup.");
+        return false;
+    }
+
+    vl_room_setups setups = vl_room_setup_load();
+    setups.erase(std::remove_if(setups.begin(), setups.end(), [&](const vl_room_setup& s) {
+        return s.serial_b == setup.serial_b && s.serial_c == setup.serial_c;
+    }), setups.end());
+    setups.push_back(setup);
+
+    Json::Value root;
+    root["version"] = ROOM_SETUP_VERSION;
+    root["setups"] = Json::Value(Json::arrayValue);
+    for (const vl_room_setup& s : setups) {
+        Json::Value entry;
+        entry["serial_b"] = s.serial_b;
+        entry["serial_c"] = s.serial_c;
+        entry["pose_b"] = pose_to_json(s.pose_b);
+        entry["pose_c"] = pose_to_json(s.pose_c);
+        entry["rms"] = s.rms;
+        entry["frames"] = s.frames;
+        root["setups"].append(entry);
+    }
+
+    // Write a new file and move it in place, a crash must not leave a
+    // truncated cache behind.
+    std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path);
+    Json::StreamWriterBuilder wbuilder;
+    file << Json::writeString(wbuilder, root);
+    file.close();
+
+    if (!file.good() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        vl_warn("Failed to write %s", path.c_str());
+        return false;
+    }
+
+    vl_info("Saved room setup for stations 0x%08x and 0x%08x to %s",
+            setup.serial_b, setup.serial_c, path.c_str());
+
+    return true;
+}
+
+const vl_room_setup* vl_room_setup_find(const vl_room_setups& setups,
+                                        uint32_t serial_b, uint32_t serial_c) {
+    for (const vl_room_setup& setup : setups)
+        if (setup.serial_b == serial_b && setup.serial_c == serial_c)
+            return &setup;
+    return nullptr;
+}
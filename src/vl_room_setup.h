@@ -0,0 +1,69 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include "vl_triangulate.h"
+
+// Placement of the two base stations in mode B+C
+//
+// The room frame is the frame of station B. The stations are told
+// apart by the ids they send over-the-light, 0 if it was not decoded.
+struct vl_room_setup {
+    uint32_t serial_b = 0;
+    uint32_t serial_c = 0;
+    vl_station_pose pose_b = vl_station_pose::Identity();
+    vl_station_pose pose_c = vl_station_pose::Identity();
+    // root mean square model fit residual, in meters
+    double rms = 0;
+    unsigned frames = 0;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::vector<vl_room_setup, Eigen::aligned_allocator<vl_room_setup>> vl_room_setups;
+
+// Model to station transform of a single frame, e.g. from PnP.
+typedef std::function<bool(const vl_light_frame&, Eigen::Isometry3d*)> vl_frame_solver;
+
+// Estimate the pose of station C from frames where both stations saw
+// the device.
+//
+// Every frame pair gives an estimate from solve_frame. These run in
+// parallel and are averaged, then the pose is refined over all frames
+// at once by minimizing the residuals of fitting the model to the
+// triangulated sensors. Returns false if no frame could be solved.
+bool vl_room_setup_solve(const vl_station_readings& R_B,
+                         const vl_station_readings& R_C,
+                         const vl_model_points& model,
+                         const vl_frame_solver& solve_frame,
+                         vl_room_setup* setup);
+
+// Room setups cached across runs, keyed by both station serials.
+vl_room_setups vl_room_setup_load();
+bool vl_room_setup_save(const vl_room_setup& setup);
+const vl_room_setup* vl_room_setup_find(const vl_room_setups& setups,
+                                        uint32_t serial_b, uint32_t serial_c);
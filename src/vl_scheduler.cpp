@@ -0,0 +1,139 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "vl_log.h"
+#include "vl_math.h"
+#include "vl_scheduler.h"
+
+static const char* mode_names[] = { "active", "idle", "unworn", "asleep" };
+
+void vl_scheduler::set_mode(vl_rate_mode new_mode) {
+    if (new_mode == mode)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    stats_.time_in_mode[static_cast<int>(mode)] += now - mode_since;
+    mode_since = now;
+
+    vl_debug("Processing rate %s -> %s", mode_names[static_cast<int>(mode)],
+             mode_names[static_cast<int>(new_mode)]);
+    mode = new_mode;
+    corrections = 0;
+    publishes = 0;
+}
+
+void vl_scheduler::update(const Eigen::Vector3d& angular_velocity, const Eigen::Vector3d& acceleration, bool still) {
+    stats_.samples++;
+
+    moving = !still ||
+             angular_velocity.norm() > VL_WAKE_GYRO ||
+             std::abs(acceleration.norm() - VL_GRAVITY_EARTH) > VL_WAKE_ACCEL;
+
+    update_mode();
+}
+
+void vl_scheduler::set_worn(bool is_worn) {
+    worn = is_worn;
+    update_mode();
+}
+
+void vl_scheduler::update_mode() {
+    if (worn)
+        set_mode(moving ? vl_rate_mode::ACTIVE : vl_rate_mode::IDLE);
+    else
+        set_mode(moving ? vl_rate_mode::UNWORN : vl_rate_mode::ASLEEP);
+}
+
+bool vl_scheduler::correction_due() {
+    unsigned divider = mode == vl_rate_mode::IDLE ? VL_IDLE_CORRECTION_DIVIDER
+                     : mode == vl_rate_mode::ASLEEP ? VL_ASLEEP_CORRECTION_DIVIDER
+                     : 1;
+
+    if (corrections++ % divider == 0)
+        return true;
+
+    stats_.corrections_skipped++;
+    return false;
+}
+
+bool vl_scheduler::publish_due() {
+    unsigned divider = mode == vl_rate_mode::IDLE ? VL_IDLE_PUBLISH_DIVIDER
+                     : mode == vl_rate_mode::UNWORN ? VL_UNWORN_PUBLISH_DIVIDER
+                     : mode == vl_rate_mode::ASLEEP ? VL_ASLEEP_PUBLISH_DIVIDER
+                     : 1;
+
+    if (publishes++ % divider == 0) {
+        stats_.publishes++;
+        return true;
+    }
+
+    stats_.publishes_skipped++;
+    return false;
+}
+
+void vl_scheduler::add_update_time(bool corrected, std::chrono::steady_clock::duration time) {
+    if (corrected) {
+        stats_.correction_time += time;
+        stats_.corrections_run++;
+    } else {
+        stats_.plain_time += time;
+        stats_.plain_run++;
+    }
+}
+
+void vl_scheduler::add_optical_time(std::chrono::steady_clock::duration time) {
+    stats_.optical_time += time;
+    stats_.optical_reports++;
+}
+
+void vl_scheduler::print_stats() {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    using std::chrono::milliseconds;
+
+    // close the running mode
+    auto now = std::chrono::steady_clock::now();
+    stats_.time_in_mode[static_cast<int>(mode)] += now - mode_since;
+    mode_since = now;
+
+    auto mean_us = [](std::chrono::steady_clock::duration time, uint64_t count) {
+        return count ? (double) duration_cast<std::chrono::nanoseconds>(time).count() / 1000.0 / count : 0.0;
+    };
+
+    // a skipped correction saves the difference to a plain update
+    double correction_saved = std::max(0.0, mean_us(stats_.correction_time, stats_.corrections_run) -
+                                            mean_us(stats_.plain_time, stats_.plain_run));
+    double saved_ms = (stats_.corrections_skipped * correction_saved +
+                       stats_.optical_reports_skipped * mean_us(stats_.optical_time, stats_.optical_reports)) / 1000.0;
+
+    vl_info("Processing rates: active %lldms, idle %lldms, unworn %lldms, asleep %lldms",
+            (long long) duration_cast<milliseconds>(stats_.time_in_mode[0]).count(),
+            (long long) duration_cast<milliseconds>(stats_.time_in_mode[1]).count(),
+            (long long) duration_cast<milliseconds>(stats_.time_in_mode[2]).count(),
+            (long long) duration_cast<milliseconds>(stats_.time_in_mode[3]).count());
+    vl_info("Skipped %llu of %llu corrections, %llu of %llu publishes, %llu optical reports",
+            (unsigned long long) stats_.corrections_skipped, (unsigned long long) stats_.samples,
+            (unsigned long long) stats_.publishes_skipped,
+            (unsigned long long) (stats_.publishes + stats_.publishes_skipped),
+            (unsigned long long) stats_.optical_reports_skipped);
+    vl_info("Estimated processor time saved: %.1fms (publishing not included)", saved_ms);
+}
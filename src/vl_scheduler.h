@@ -0,0 +1,101 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include <Eigen/Core>
+
+// Work done every n-th time while idle (still), unworn and asleep
+// (still and not worn). Orientation is kept up while unworn, as the
+// headset may be put on any moment.
+#define VL_IDLE_CORRECTION_DIVIDER 10
+#define VL_ASLEEP_CORRECTION_DIVIDER 100
+#define VL_IDLE_PUBLISH_DIVIDER 10
+#define VL_UNWORN_PUBLISH_DIVIDER 10
+#define VL_ASLEEP_PUBLISH_DIVIDER 100
+
+// A single sample beyond these wakes the scheduler up.
+#define VL_WAKE_GYRO 0.2 // rad/s, bias corrected
+#define VL_WAKE_ACCEL 1.0 // m/s^2 off from gravity
+
+enum class vl_rate_mode {
+    ACTIVE,
+    IDLE,
+    UNWORN,
+    ASLEEP,
+};
+
+// Lowers processing rates while nothing changes
+//
+// The stillness detector decides when to slow down, but it needs a
+// window of samples. Going back to full rate is decided on every
+// sample by a plain threshold, so motion is never processed late.
+// Taking the headset off slows down as well, putting it on goes back
+// to full rate with the next mainboard report, see vl_mainboard_state.
+//
+//	correction_due()	gravity correction, every sample while
+//				active
+//	publish_due()		pose publishing, on every call while active
+//	optical_enabled()	lighthouse processing, paused unless active
+class vl_scheduler {
+    vl_rate_mode mode = vl_rate_mode::ACTIVE;
+    bool worn = true;
+    bool moving = true;
+    unsigned corrections = 0;
+    unsigned publishes = 0;
+    std::chrono::steady_clock::time_point mode_since = std::chrono::steady_clock::now();
+
+    void set_mode(vl_rate_mode new_mode);
+    void update_mode();
+
+public:
+    struct stats {
+        uint64_t samples = 0;
+        uint64_t corrections_skipped = 0;
+        uint64_t publishes = 0;
+        uint64_t publishes_skipped = 0;
+        uint64_t optical_reports_skipped = 0;
+        std::chrono::steady_clock::duration time_in_mode[4] = {};
+
+        // measured cost of the work that did run, to estimate the savings
+        std::chrono::steady_clock::duration correction_time = {};
+        std::chrono::steady_clock::duration plain_time = {};
+        uint64_t corrections_run = 0;
+        uint64_t plain_run = 0;
+        std::chrono::steady_clock::duration optical_time = {};
+        uint64_t optical_reports = 0;
+    } stats_;
+
+    void update(const Eigen::Vector3d& angular_velocity, const Eigen::Vector3d& acceleration, bool still);
+    void set_worn(bool is_worn);
+
+    vl_rate_mode get_mode() const { return mode; }
+    bool correction_due();
+    bool publish_due();
+    bool optical_enabled() const { return mode == vl_rate_mode::ACTIVE; }
+
+    void add_update_time(bool corrected, std::chrono::steady_clock::duration time);
+    void add_optical_time(std::chrono::steady_clock::duration time);
+    void skip_optical_report() { stats_.optical_reports_skipped++; }
+
+    void print_stats();
+};
@@ -0,0 +1,63 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Lock-free single producer, single consumer ring buffer
+//
+// One thread may push() while another one pop()s. The indices only
+// grow, their difference is the fill level. Both sit on their own
+// cache line, so the two threads do not bounce one. Heap allocated
+// owners need -faligned-new before C++17.
+template <typename T, size_t N>
+class vl_spsc_queue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "the size must be a power of two");
+
+    std::array<T, N> items;
+    alignas(64) std::atomic<size_t> head { 0 }; // next to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail { 0 }; // next to push, written by the producer
+
+public:
+    // Returns false when full, the item is dropped.
+    bool push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+            return false;
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T* item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        *item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
@@ -0,0 +1,100 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <cmath>
+
+#include "vl_math.h"
+#include "vl_stillness.h"
+
+#define GRAVITY_TOLERANCE 0.4 // m/s^2, as in vl_fusion::correct_gravity()
+
+vl_window_stats::vl_window_stats(size_t window) : samples(window) {
+}
+
+void vl_window_stats::clear() {
+    next = 0;
+    count = 0;
+    mean_.setZero();
+    m2.setZero();
+}
+
+void vl_window_stats::add(const Eigen::Vector3d& x) {
+    if (count == samples.size()) {
+        const Eigen::Vector3d& old = samples[next];
+        count--;
+        if (count == 0) {
+            mean_.setZero();
+            m2.setZero();
+        } else {
+            Eigen::Vector3d delta = old - mean_;
+            mean_ -= delta / count;
+            m2 -= delta.cwiseProduct(old - mean_);
+        }
+    }
+
+    samples[next] = x;
+    next = (next + 1) % samples.size();
+
+    count++;
+    Eigen::Vector3d delta = x - mean_;
+    mean_ += delta / count;
+    m2 += delta.cwiseProduct(x - mean_);
+
+    // rounding in the removal can leave tiny negative sums
+    m2 = m2.cwiseMax(0.0);
+}
+
+Eigen::Vector3d vl_window_stats::variance() const {
+    if (count < 2)
+        return Eigen::Vector3d::Zero();
+    return m2 / (count - 1);
+}
+
+vl_stillness::vl_stillness(size_t window) : gyro(window), accel(window) {
+}
+
+void vl_stillness::reset() {
+    gyro.clear();
+    accel.clear();
+    still = false;
+    probability_ = 0;
+}
+
+void vl_stillness::update(const Eigen::Vector3d& angular_velocity, const Eigen::Vector3d& acceleration) {
+    gyro.add(angular_velocity);
+    accel.add(acceleration);
+
+    if (!gyro.full()) {
+        probability_ = 0;
+        still = false;
+        return;
+    }
+
+    double gyro_score = gyro.variance().sum() / (VL_STILLNESS_GYRO_STD * VL_STILLNESS_GYRO_STD);
+    double accel_score = accel.variance().sum() / (VL_STILLNESS_ACCEL_STD * VL_STILLNESS_ACCEL_STD);
+    double bias_score = gyro.mean().squaredNorm() / (VL_STILLNESS_GYRO_MEAN * VL_STILLNESS_GYRO_MEAN);
+    double gravity_error = (accel.mean().norm() - VL_GRAVITY_EARTH) / GRAVITY_TOLERANCE;
+
+    probability_ = std::exp(-0.5 * (gyro_score + accel_score + bias_score + gravity_error * gravity_error));
+
+    if (still && probability_ < VL_STILLNESS_LEAVE)
+        still = false;
+    else if (!still && probability_ > VL_STILLNESS_ENTER)
+        still = true;
+}
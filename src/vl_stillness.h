@@ -0,0 +1,85 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+// IMU samples in a stillness window, 1000 Hz IMU rate.
+#define VL_STILLNESS_WINDOW 100
+
+// Scales of the stillness probability, several times the sensor noise
+// of a device at rest. Standard deviations are over all three axes.
+#define VL_STILLNESS_GYRO_STD 0.05 // rad/s
+#define VL_STILLNESS_ACCEL_STD 0.2 // m/s^2
+#define VL_STILLNESS_GYRO_MEAN 0.1 // rad/s, larger is not bias
+
+// Hysteresis on the stillness probability
+#define VL_STILLNESS_ENTER 0.6
+#define VL_STILLNESS_LEAVE 0.3
+
+// Mean and variance of the last window samples, O(1) per sample
+//
+// Welford's update adds the new sample, its reverse removes the one
+// that falls out of the window.
+class vl_window_stats {
+    std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d>> samples;
+    size_t next = 0;
+    size_t count = 0;
+    Eigen::Vector3d mean_ = Eigen::Vector3d::Zero();
+    Eigen::Vector3d m2 = Eigen::Vector3d::Zero();
+
+public:
+    vl_window_stats(size_t window);
+    void add(const Eigen::Vector3d& x);
+    void clear();
+
+    bool full() const { return count == samples.size(); }
+    const Eigen::Vector3d& mean() const { return mean_; }
+    // per axis
+    Eigen::Vector3d variance() const;
+};
+
+// Detects a device at rest from the IMU
+//
+// The probability falls with the gyro and accel noise above what a
+// device at rest shows, with the gyro mean beyond a plausible bias and
+// with the accel mean off from gravity. The device counts as still
+// once the probability rises above VL_STILLNESS_ENTER over a full
+// window, and as moving again when it drops below VL_STILLNESS_LEAVE.
+class vl_stillness {
+    vl_window_stats gyro;
+    vl_window_stats accel;
+    bool still = false;
+    double probability_ = 0;
+
+public:
+    vl_stillness(size_t window = VL_STILLNESS_WINDOW);
+    void update(const Eigen::Vector3d& angular_velocity, const Eigen::Vector3d& acceleration);
+    void reset();
+
+    bool is_still() const { return still; }
+    double probability() const { return probability_; }
+    // means over the window, in device coordinates
+    const Eigen::Vector3d& gyro_mean() const { return gyro.mean(); }
+    const Eigen::Vector3d& accel_mean() const { return accel.mean(); }
+};
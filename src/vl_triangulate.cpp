@@ -0,0 +1,133 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Geometry>
+
+#include "vl_triangulate.h"
+
+std::vector<vl_frame_pair> vl_pair_frames(const vl_station_readings& R_B,
+                                          const vl_station_readings& R_C) {
+    std::vector<vl_frame_pair> pairs;
+    pairs.reserve(std::min(R_B.size(), R_C.size()));
+
+    auto b = R_B.begin();
+    auto c = R_C.begin();
+    while (b != R_B.end() && c != R_C.end()) {
+        if (b->seq < c->seq) {
+            ++b;
+        } else if (c->seq < b->seq) {
+            ++c;
+        } else {
+            pairs.push_back(vl_frame_pair(&*b, &*c));
+            ++b;
+            ++c;
+        }
+    }
+
+    return pairs;
+}
+
+Eigen::Vector3d vl_sweep_ray(uint32_t x_ticks, uint32_t y_ticks) {
+    return Eigen::Vector3d(
+                std::tan(angle_ticks_to_rad(x_ticks)),
+                std::tan(angle_ticks_to_rad(y_ticks)),
+                1.0).normalized();
+}
+
+vl_triangulation vl_triangulate(const vl_light_frame& frame_b,
+                                const vl_light_frame& frame_c,
+                                const vl_station_pose& pose_b,
+                                const vl_station_pose& pose_c) {
+    vl_triangulation result;
+
+    uint32_t both = frame_b.visible & frame_c.visible;
+    unsigned n = __builtin_popcount(both);
+
+    result.sensors.reserve(n);
+    Eigen::Matrix3Xd d1(3, n), d2(3, n);
+
+    for (unsigned s = 0, i = 0; s < VL_MAX_SENSORS; s++) {
+        if (!(both & (1u << s)))
+            continue;
+        result.sensors.push_back(s);
+        d1.col(i) = vl_sweep_ray(frame_b.x[s], frame_b.y[s]);
+        d2.col(i) = vl_sweep_ray(frame_c.x[s], frame_c.y[s]);
+        i++;
+    }
+
+    // rays into room coordinates
+    d1 = pose_b.linear() * d1;
+    d2 = pose_c.linear() * d2;
+    const Eigen::Vector3d o1 = pose_b.translation();
+    const Eigen::Vector3d o2 = pose_c.translation();
+    const Eigen::Vector3d w0 = o1 - o2;
+
+    // Closest points o1 + s d1 and o2 + t d2 of each pair of unit rays.
+    Eigen::RowVectorXd b = (d1.array() * d2.array()).colwise().sum();
+    Eigen::RowVectorXd d = w0.transpose() * d1;
+    Eigen::RowVectorXd e = w0.transpose() * d2;
+    Eigen::RowVectorXd denom = 1.0 - b.array().square();
+
+    Eigen::RowVectorXd s = (b.array() * e.array() - d.array()) / denom.array();
+    Eigen::RowVectorXd t = (e.array() - b.array() * d.array()) / denom.array();
+
+    // Parallel rays do not intersect, leave them at the stations.
+    const auto parallel = denom.array() < 1e-12;
+    s = parallel.select(0.0, s);
+    t = parallel.select(0.0, t);
+
+    Eigen::Matrix3Xd p1 = d1.array().rowwise() * s.array();
+    Eigen::Matrix3Xd p2 = d2.array().rowwise() * t.array();
+    p1.colwise() += o1;
+    p2.colwise() += o2;
+
+    result.points = 0.5 * (p1 + p2);
+    result.gap = (p1 - p2).colwise().norm().transpose();
+
+    return result;
+}
+
+bool vl_fit_rigid(const vl_model_points& model,
+                  const vl_triangulation& measured,
+                  Eigen::Isometry3d* model_to_room,
+                  double* rms) {
+    unsigned n = measured.sensors.size();
+    if (n < 3)
+        return false;
+
+    Eigen::Matrix3Xd src(3, n);
+    for (unsigned i = 0; i < n; i++) {
+        if (measured.sensors[i] >= model.size())
+            return false;
+        src.col(i) = model[measured.sensors[i]];
+    }
+
+    // Umeyama without scaling is the Kabsch algorithm.
+    model_to_room->matrix() = Eigen::umeyama(src, measured.points, false);
+
+    if (rms) {
+        Eigen::Matrix3Xd residual = ((*model_to_room) * src) - measured.points;
+        *rms = std::sqrt(residual.squaredNorm() / n);
+    }
+
+    return true;
+}
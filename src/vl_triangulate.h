@@ -0,0 +1,74 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include "vl_hid_reports.h"
+#include "vl_light.h"
+
+typedef std::vector<Eigen::Vector3d> vl_model_points;
+
+// Station to room transform. The station looks down +z, with x along
+// the horizontal sweep and y along the vertical sweep.
+typedef Eigen::Isometry3d vl_station_pose;
+
+// Frames of station B and C from the same scanning cycle.
+typedef std::pair<const vl_light_frame*, const vl_light_frame*> vl_frame_pair;
+
+// Pair up the frames of both stations by their sequence number. Both
+// readings are sorted by seq, as returned by collect_readings().
+std::vector<vl_frame_pair> vl_pair_frames(const vl_station_readings& R_B,
+                                          const vl_station_readings& R_C);
+
+// Unit ray from the station through a sensor, in station coordinates.
+Eigen::Vector3d vl_sweep_ray(uint32_t x_ticks, uint32_t y_ticks);
+
+// Sensors seen by both stations in one scanning cycle.
+//
+//	sensors	sensor ids, one per column of points
+//	points	triangulated positions in room coordinates
+//	gap	distance between the two rays at their closest approach,
+//		a measure of how well the pair of rays agreed
+struct vl_triangulation {
+    std::vector<unsigned> sensors;
+    Eigen::Matrix3Xd points;
+    Eigen::VectorXd gap;
+};
+
+// Intersect the rays of all co-visible sensors of two frames with the
+// midpoint method. All sensors are handled at once as 3xN matrices.
+vl_triangulation vl_triangulate(const vl_light_frame& frame_b,
+                                const vl_light_frame& frame_c,
+                                const vl_station_pose& pose_b,
+                                const vl_station_pose& pose_c);
+
+// Rigid body fit of model points onto triangulated points (Kabsch)
+//
+// Returns false with fewer than 3 points. rms is the residual root
+// mean square distance in meters, if not null.
+bool vl_fit_rigid(const vl_model_points& model,
+                  const vl_triangulation& measured,
+                  Eigen::Isometry3d* model_to_room,
+                  double* rms = nullptr);
@@ -0,0 +1,41 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <cmath>
+
+#include "vl_visibility.h"
+
+uint32_t vl_visible_sensors(const vl_model_points& model,
+                            const vl_model_normals& normals,
+                            const Eigen::Isometry3d& model_to_station,
+                            double max_incidence) {
+    uint32_t mask = 0xffffffff;
+    double min_cos = std::cos(max_incidence);
+
+    for (unsigned s = 0; s < VL_MAX_SENSORS && s < model.size() && s < normals.size(); s++) {
+        // direction from the sensor to the station at the origin
+        Eigen::Vector3d to_station = -(model_to_station * model[s]);
+        Eigen::Vector3d normal = model_to_station.linear() * normals[s];
+
+        if (normal.dot(to_station) < min_cos * to_station.norm())
+            mask &= ~(1u << s);
+    }
+
+    return mask;
+}
@@ -0,0 +1,51 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include "vl_triangulate.h"
+
+// Unit normals of the sensors, model coordinates, same order as the
+// model points.
+typedef std::vector<Eigen::Vector3d> vl_model_normals;
+
+// Largest angle between a sensor normal and the direction to the
+// station at which the sensor may still be hit. Slightly beyond the
+// horizon, so a pose off by a few degrees does not cull real hits.
+#define VL_SENSOR_MAX_INCIDENCE (95.0 * M_PI / 180.0)
+
+// Sensors that can face a station
+//
+// mask = vl_visible_sensors(model, normals, model_to_station)
+//
+//	model_to_station	device pose in the station frame, the
+//				station sits at the origin
+//
+//	mask	bit s set when sensor s faces the station closer than
+//		max_incidence. All bits of sensors without a normal are
+//		set, so an empty normals vector disables culling.
+uint32_t vl_visible_sensors(const vl_model_points& model,
+                            const vl_model_normals& normals,
+                            const Eigen::Isometry3d& model_to_station,
+                            double max_incidence = VL_SENSOR_MAX_INCIDENCE);
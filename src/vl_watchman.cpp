@@ -0,0 +1,90 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <string>
+
+#include "vl_log.h"
+#include "vl_watchman.h"
+
+const char* vl_watchman_event_name(vl_watchman_event_type type) {
+    switch (type) {
+    case vl_watchman_event_type::IMU:
+        return "imu";
+    case vl_watchman_event_type::BUTTONS:
+        return "buttons";
+    case vl_watchman_event_type::TRACKPAD:
+        return "trackpad";
+    case vl_watchman_event_type::TRIGGER:
+        return "trigger";
+    case vl_watchman_event_type::BATTERY:
+        return "battery";
+    }
+    return "unknown";
+}
+
+static std::string button_names(uint8_t buttons) {
+    static const struct {
+        uint8_t flag;
+        const char* name;
+    } names[] = {
+        { vl_controller_button::TRIGGER, "trigger" },
+        { vl_controller_button::TOUCH, "touch" },
+        { vl_controller_button::TOUCH_PRESS, "touch press" },
+        { vl_controller_button::SYSTEM, "system" },
+        { vl_controller_button::GRIP, "grip" },
+        { vl_controller_button::MENU, "menu" },
+    };
+
+    std::string str;
+    for (const auto& button : names) {
+        if (!(buttons & button.flag))
+            continue;
+        if (!str.empty())
+            str += ", ";
+        str += button.name;
+    }
+    return str.empty() ? "nothing" : str;
+}
+
+void vl_watchman_print_event(const vl_watchman_event& event, uint64_t ticks) {
+    double time = ticks / 48000000.0;
+
+    switch (event.type) {
+    case vl_watchman_event_type::IMU:
+        vl_info("%f: accel(%d, %d, %d) gyro(%d, %d, %d)", time,
+                event.imu.accel[0], event.imu.accel[1], event.imu.accel[2],
+                event.imu.gyro[0], event.imu.gyro[1], event.imu.gyro[2]);
+        break;
+    case vl_watchman_event_type::BUTTONS:
+        vl_info("%f: buttons %s", time, button_names(event.buttons).c_str());
+        break;
+    case vl_watchman_event_type::TRACKPAD:
+        vl_info("%f: trackpad (%f, %f)", time,
+                event.trackpad.x / 32768.0, event.trackpad.y / 32768.0);
+        break;
+    case vl_watchman_event_type::TRIGGER:
+        vl_info("%f: trigger %d", time, event.trigger);
+        break;
+    case vl_watchman_event_type::BATTERY:
+        vl_info("%f: %s: %d%%", time,
+                event.battery.charging ? "charging" : "discharging",
+                event.battery.charge);
+        break;
+    }
+}
@@ -0,0 +1,277 @@
+/*
+ * Vive Libre
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "vl_enums.h"
+#include "vl_reorder.h"
+
+// One controller per watchman dongle.
+#define VL_WATCHMAN_CONTROLLERS 2
+
+// Controller reports carry one (0x23) or two (0x24) message slots.
+#define VL_WATCHMAN_SLOT_SIZE 29
+
+// Bytes of the typed parts of a message.
+#define VL_WATCHMAN_IMU_SIZE 13
+#define VL_WATCHMAN_TRACKPAD_SIZE 4
+
+enum class vl_watchman_event_type : uint8_t {
+    IMU,
+    BUTTONS,
+    TRACKPAD,
+    TRIGGER,
+    BATTERY,
+};
+
+struct vl_watchman_imu {
+    int16_t accel[3];
+    int16_t gyro[3];
+};
+
+struct vl_watchman_trackpad {
+    int16_t x;
+    int16_t y;
+};
+
+struct vl_watchman_battery {
+    uint8_t charge; // percent
+    bool charging;
+};
+
+// A typed controller measurement
+//
+// The message header only has the upper two bytes of the 32 bit
+// controller clock in time1 and time2. IMU messages add the next byte
+// in time3, which is 0 for the other types.
+struct vl_watchman_event {
+    vl_watchman_event_type type;
+    uint8_t time1;
+    uint8_t time2;
+    uint8_t time3;
+    union {
+        vl_watchman_imu imu;
+        uint8_t buttons; // vl_controller_button flags
+        vl_watchman_trackpad trackpad;
+        uint8_t trigger;
+        vl_watchman_battery battery;
+    };
+
+    uint32_t ticks() const {
+        return ((uint32_t) time1 << 24) | (time2 << 16) | (time3 << 8);
+    }
+};
+
+// 64 bit controller clock from the time fragments of its messages
+//
+// IMU messages give bits 8 to 31 of the clock, the others only bits 16
+// to 31, so a button press is known to 1.4ms. The fragments are
+// unwrapped like vl_tick_unwrapper, which bridges dropped messages of
+// up to ~44s. Within the unknown low bits an event is placed right
+// after the previous one, so the times of a controller never go
+// backwards unless the fragments do. Use one clock per controller, the
+// two dongles interleave their reports.
+class vl_watchman_clock {
+    vl_tick_unwrapper unwrapper;
+    uint64_t last = 0;
+
+public:
+    uint64_t update(const vl_watchman_event& event) {
+        uint64_t time = unwrapper.unwrap(event.ticks());
+        uint32_t unknown = event.type == vl_watchman_event_type::IMU ? 0xff : 0xffff;
+
+        if (last > time && last <= time + unknown)
+            time = last;
+
+        last = time;
+        return time;
+    }
+
+    void reset() {
+        unwrapper.reset();
+        last = 0;
+    }
+
+    // time of the last event
+    uint64_t get_last() const { return last; }
+};
+
+struct vl_watchman_parse_stats {
+    uint64_t messages = 0;
+    uint64_t events = 0;
+    // message types or trailing data that are not decoded, like the
+    // lighthouse pulses
+    uint64_t skipped = 0;
+    // lengths that run past the slot or the typed part
+    uint64_t malformed = 0;
+};
+
+static inline int16_t vl_watchman_int16(const uint8_t* p) {
+    return static_cast<int16_t>(p[0] | (p[1] << 8));
+}
+
+// Decode one message of a slot
+//
+// A message is a 4 byte header of time1, length, time2 and type, and
+// length - 2 bytes of payload. Types 0xf0 to 0xff are a set of fields:
+// 0x01 buttons (1 byte), 0x04 trigger (1 byte) and 0x02 trackpad
+// (4 bytes), in that order. A following 0xe* byte starts another typed
+// part in the same payload, like an IMU sample after the buttons.
+template <typename Sink>
+bool vl_watchman_parse_message(const uint8_t* p, size_t size, Sink&& sink, vl_watchman_parse_stats* stats) {
+    // an empty slot
+    if (size < 4 || p[1] == 0)
+        return true;
+
+    uint8_t length = p[1];
+    if (length < 2 || length > size - 2) {
+        stats->malformed++;
+        return false;
+    }
+
+    vl_watchman_event event;
+    event.time1 = p[0];
+    event.time2 = p[2];
+    event.time3 = 0;
+    uint8_t type = p[3];
+
+    const uint8_t* payload = p + 4;
+    const uint8_t* end = p + 2 + length;
+
+    stats->messages++;
+
+    if ((type & 0xf0) == 0xf0) {
+        if (type & 0x01) {
+            if (end - payload < 1)
+                goto malformed;
+            event.type = vl_watchman_event_type::BUTTONS;
+            event.buttons = *payload++;
+            sink(event);
+            stats->events++;
+        }
+        if (type & 0x04) {
+            if (end - payload < 1)
+                goto malformed;
+            event.type = vl_watchman_event_type::TRIGGER;
+            event.trigger = *payload++;
+            sink(event);
+            stats->events++;
+        }
+        if (type & 0x02) {
+            if (end - payload < VL_WATCHMAN_TRACKPAD_SIZE)
+                goto malformed;
+            event.type = vl_watchman_event_type::TRACKPAD;
+            event.trackpad.x = vl_watchman_int16(payload);
+            event.trackpad.y = vl_watchman_int16(payload + 2);
+            payload += VL_WATCHMAN_TRACKPAD_SIZE;
+            sink(event);
+            stats->events++;
+        }
+
+        if (payload == end)
+            return true;
+        if ((*payload & 0xf0) != 0xe0) {
+            stats->skipped++;
+            return true;
+        }
+        type = *payload++;
+    }
+
+    switch (static_cast<vl_controller_type>(type)) {
+    case vl_controller_type::IMU:
+        if (end - payload < VL_WATCHMAN_IMU_SIZE)
+            goto malformed;
+        event.type = vl_watchman_event_type::IMU;
+        event.time3 = payload[0];
+        for (int i = 0; i < 3; i++) {
+            event.imu.accel[i] = vl_watchman_int16(payload + 1 + 2 * i);
+            event.imu.gyro[i] = vl_watchman_int16(payload + 7 + 2 * i);
+        }
+        payload += VL_WATCHMAN_IMU_SIZE;
+        sink(event);
+        stats->events++;
+        break;
+    case vl_controller_type::PING:
+        if (end - payload < 1)
+            goto malformed;
+        event.type = vl_watchman_event_type::BATTERY;
+        event.battery.charge = payload[0] & 0x7f;
+        event.battery.charging = payload[0] & 0x80;
+        // the rest is an IMU sample without time3, not decoded
+        payload = end;
+        sink(event);
+        stats->events++;
+        break;
+    default:
+        payload = end;
+        stats->skipped++;
+        break;
+    }
+
+    if (payload != end)
+        stats->skipped++;
+
+    return true;
+
+malformed:
+    stats->malformed++;
+    return false;
+}
+
+// Single pass over a controller report, calling sink with every typed
+// event in order. The report bytes are read in place. Returns false
+// for a report that is not a controller report or has a malformed
+// message, after the events before it were delivered.
+template <typename Sink>
+bool vl_watchman_parse(const uint8_t* buffer, size_t size, Sink&& sink, vl_watchman_parse_stats* stats) {
+    if (size < 1)
+        return false;
+
+    unsigned slots;
+    switch (static_cast<vl_report_id>(buffer[0])) {
+    case vl_report_id::CONTROLLER1:
+        slots = 1;
+        break;
+    case vl_report_id::CONTROLLER2:
+        slots = 2;
+        break;
+    default:
+        return false;
+    }
+
+    bool valid = true;
+    for (unsigned i = 0; i < slots; i++) {
+        size_t offset = 1 + i * VL_WATCHMAN_SLOT_SIZE;
+        if (offset >= size) {
+            stats->malformed++;
+            return false;
+        }
+        size_t slot_size = std::min<size_t>(VL_WATCHMAN_SLOT_SIZE, size - offset);
+        valid &= vl_watchman_parse_message(buffer + offset, slot_size, sink, stats);
+    }
+
+    return valid;
+}
+
+const char* vl_watchman_event_name(vl_watchman_event_type type);
+void vl_watchman_print_event(const vl_watchman_event& event, uint64_t time);
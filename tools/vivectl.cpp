@@ -1,14 +1,31 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
 #include <fstream>
-#include <iostream>
+#include <random>
+#include <sstream>
 #include <stdio.h>
 #include <signal.h>
 #include <string>
+#include <thread>
 #include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "vl_cache.h"
 #include "vl_config.h"
+#include "vl_daemon.h"
+#include "vl_distortion.h"
 #include "vl_driver.h"
 #include "vl_enums.h"
 #include "vl_light.h"
 #include "vl_log.h"
+#include "vl_math.h"
+#include "vl_optical.h"
+#include "vl_pose_export.h"
+#include "vl_watchman.h"
 
 static bool should_exit = false;
 static vl_driver* driver;
@@ -32,8 +49,62 @@ static void dump_controller() {
     CHECK(vl_driver_stop_watchman_capture(driver), return);
 }
 
+// Raw controller reports for bench watchman, each as a size byte and
+// the report.
+#define CONTROLLER_RECORDING "controller-reports.bin"
+
+static std::ofstream controller_recording;
+
+static void record_controller(uint8_t* buffer, int size, vl_driver* driver) {
+    (void)driver;
+    if (size <= 0 || size > 255)
+        return;
+    controller_recording.put((char) size);
+    controller_recording.write((const char*) buffer, size);
+}
+
+static void dump_controller_raw() {
+    controller_recording.open(CONTROLLER_RECORDING, std::ios::binary | std::ios::trunc);
+    CHECK(controller_recording.is_open(), vl_error("Could not open %s.", CONTROLLER_RECORDING); return);
+    CHECK(vl_driver_start_watchman_capture(driver, record_controller), return);
+    while (!should_exit)
+        CHECK(driver->poll(), break);
+    CHECK(vl_driver_stop_watchman_capture(driver), return);
+    controller_recording.close();
+    vl_info("Wrote %s.", CONTROLLER_RECORDING);
+}
+
+static void dump_controller_input() {
+    CHECK(vl_driver_start_watchman_capture(driver, vl_driver_update_controller), return);
+    while (!should_exit) {
+        CHECK(driver->poll(), break);
+        vl_input_event event;
+        while (driver->input_events.pop(&event)) {
+            if (event.type == vl_input_event_type::AXIS)
+                vl_info("%lu controller %d axis %d: %.3f", event.time, event.controller,
+                        static_cast<int>(event.axis), event.value);
+            else
+                vl_info("%lu controller %d button 0x%02x %s", event.time, event.controller, event.button,
+                        event.type == vl_input_event_type::PRESS ? "pressed" : "released");
+        }
+    }
+    CHECK(vl_driver_stop_watchman_capture(driver), return);
+}
+
+static void print_mainboard_event(const vl_mainboard_event& event) {
+    switch (event.type) {
+    case vl_mainboard_event_type::IPD:
+        vl_info("IPD: %4.1fmm", 1e-2 * event.value);
+        break;
+    default:
+        vl_info("%s: %d", vl_mainboard_event_name(event.type), event.value);
+        break;
+    }
+}
+
 static void dump_hmd_mainboard() {
-    CHECK(vl_driver_start_hmd_mainboard_capture(driver, vl_driver_log_hmd_mainboard), return);
+    driver->mainboard_sink = print_mainboard_event;
+    CHECK(vl_driver_start_hmd_mainboard_capture(driver, vl_driver_update_mainboard), return);
     while (!should_exit)
         CHECK(driver->poll(), break);
     CHECK(vl_driver_stop_hmd_mainboard_capture(driver), return);
@@ -57,7 +128,7 @@ static void send_hmd_on() {
     // turn the display on
     int hret = hid_send_feature_report(driver->hmd_device.handle,
                                    0,
-                                   vive_magic_power_on);
+                                   vl_hmd_power_command_for(vl_hmd_power_mode::ON));
     vl_info("power on magic: %d", hret);
 }
 
@@ -70,13 +141,114 @@ static void dump_hmd_light() {
     CHECK(vl_driver_stop_hmd_light_capture(driver), return);
 }
 
+// IMU orientation with optical yaw correction, see
+// vl_driver_correct_heading(). Run with debug logging to see the
+// corrections.
+static void dump_hmd_imu_heading() {
+    CHECK(driver->init_heading_correction(), return);
+    send_hmd_on();
+    driver->mainboard_sink = print_mainboard_event;
+    CHECK(vl_driver_start_hmd_mainboard_capture(driver, vl_driver_update_mainboard), return);
+    CHECK(vl_driver_start_hmd_imu_capture(driver, vl_driver_update_pose), goto out_hmd_mainboard);
+    CHECK(vl_driver_start_hmd_light_capture(driver, vl_driver_correct_heading), goto out_hmd_imu);
+    while (!should_exit)
+        CHECK(driver->poll(), break);
+    vl_driver_stop_hmd_light_capture(driver);
+out_hmd_imu:
+    vl_driver_stop_hmd_imu_capture(driver);
+out_hmd_mainboard:
+    vl_driver_stop_hmd_mainboard_capture(driver);
+    driver->scheduler.print_stats();
+}
+
+static void print_merged_event(const vl_event& event) {
+    switch (event.stream) {
+    case vl_event_stream::HMD_IMU:
+        vl_info("%lu imu seq %u", event.time, event.imu.seq);
+        break;
+    case vl_event_stream::HMD_LIGHT:
+        vl_info("%lu light sensor %u length %u", event.time,
+                event.light.sensor_id, event.light.length);
+        break;
+    case vl_event_stream::WATCHMAN1:
+    case vl_event_stream::WATCHMAN2:
+        vl_info("%lu controller %d %s", event.time,
+                event.stream == vl_event_stream::WATCHMAN1 ? 1 : 2,
+                vl_watchman_event_name(event.controller.type));
+        break;
+    default:
+        break;
+    }
+}
+
+static void dump_merged() {
+    // hmd needs to be on to receive light reports.
+    send_hmd_on();
+    driver->init_event_merge(print_merged_event);
+    CHECK(vl_driver_start_hmd_imu_capture(driver, vl_driver_merge_hmd_imu), return);
+    CHECK(vl_driver_start_hmd_light_capture(driver, vl_driver_merge_hmd_light), goto out_hmd_imu);
+    CHECK(vl_driver_start_watchman_capture(driver, vl_driver_merge_watchman), goto out_hmd_light);
+    while (!should_exit)
+        CHECK(driver->poll(), break);
+    driver->event_merge->flush();
+    vl_info("merged %lu events, %lu forced by the latency bound, %lu late",
+            driver->event_merge->stats.emitted,
+            driver->event_merge->stats.forced,
+            driver->event_merge->stats.late);
+    vl_driver_stop_watchman_capture(driver);
+out_hmd_light:
+    vl_driver_stop_hmd_light_capture(driver);
+out_hmd_imu:
+    vl_driver_stop_hmd_imu_capture(driver);
+}
+
+// Own the devices and serve their events to vivectl attach and other
+// local clients, see vl_daemon.h.
+static void run_daemon() {
+    vl_daemon_server server;
+    CHECK(server.start(), return);
+
+    // hmd needs to be on to receive light reports.
+    send_hmd_on();
+    driver->init_event_merge([&server](const vl_event& event) { server.publish(event); });
+    driver->mainboard_sink = [&server](const vl_mainboard_event& event) { server.publish(event); };
+
+    CHECK(vl_driver_start_hmd_mainboard_capture(driver, vl_driver_update_mainboard), return);
+    CHECK(vl_driver_start_hmd_imu_capture(driver, vl_driver_merge_hmd_imu), goto out_hmd_mainboard);
+    CHECK(vl_driver_start_hmd_light_capture(driver, vl_driver_merge_hmd_light), goto out_hmd_imu);
+    CHECK(vl_driver_start_watchman_capture(driver, vl_driver_merge_watchman), goto out_hmd_light);
+    while (!should_exit)
+        CHECK(driver->poll(), break);
+    driver->event_merge->flush();
+    vl_driver_stop_watchman_capture(driver);
+out_hmd_light:
+    vl_driver_stop_hmd_light_capture(driver);
+out_hmd_imu:
+    vl_driver_stop_hmd_imu_capture(driver);
+out_hmd_mainboard:
+    vl_driver_stop_hmd_mainboard_capture(driver);
+    driver->mainboard_sink = nullptr;
+    driver->event_merge.reset();
+}
+
 static void dump_config_hmd() {
     char * config = vl_get_config(driver->hmd_lighthouse_device, 0);
     vl_info("hmd_lighthouse_device config: %s", config);
 }
 
+// Generate the distortion of the headset like the plugin does, or
+// report the cached one.
+static void dump_config_distortion() {
+    CHECK(driver->init_distortion(), return);
+    while (!should_exit && !driver->distortion->ready())
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (!driver->distortion->get_meshdata_path().empty())
+        vl_info("Mesh data in %s", driver->distortion->get_meshdata_path().c_str());
+}
+
 static void dump_hmd_all() {
-    CHECK(vl_driver_start_hmd_mainboard_capture(driver, vl_driver_log_hmd_mainboard), return);
+    driver->mainboard_sink = print_mainboard_event;
+    CHECK(vl_driver_start_hmd_mainboard_capture(driver, vl_driver_update_mainboard), return);
     CHECK(vl_driver_start_watchman_capture(driver, vl_driver_log_watchman), goto out_hmd_mainboard);
     CHECK(vl_driver_start_hmd_imu_capture(driver, vl_driver_log_hmd_imu), goto out_watchman);
     CHECK(vl_driver_start_hmd_light_capture(driver, vl_driver_log_hmd_light), goto out_hmd_imu);
@@ -171,77 +343,358 @@ static void dump_station_angle_from_csv(const std::string& file_path) {
 }
 
 
-#include <json/value.h>
-#include <json/reader.h>
+// Sensor positions and normals of the headset. The normals are left
+// empty if the config has none, which disables visibility culling.
+static bool read_sensor_model(vl_model_points* model, vl_model_normals* normals) {
+    if (!vl_config_sensor_model(driver->read_config().c_str(), model, normals)) {
+        vl_error("No sensor positions in the device config.");
+        return false;
+    }
+
+    vl_info("model points size: %zu, normals size: %zu", model->size(), normals->size());
+    return true;
+}
 
 static void pnp_from_csv(const std::string& file_path) {
+    const vl_optical_module* optical = vl_optical_load();
+    if (!optical)
+        return;
+
+    vl_model_points model;
+    vl_model_normals normals;
+    if (!read_sensor_model(&model, &normals))
+        return;
 
-    // XXX
-    std::string config(vl_get_config(driver->hmd_lighthouse_device, 0));
-    //vl_info("\n\nconfig:\n\n%s\n\n", config.c_str());
-
-    std::stringstream foo;
-    foo << config;
-
-    Json::Value root;
-    Json::CharReaderBuilder rbuilder;
-    // Configure the Builder, then ...
-    std::string errs;
-    bool parsingSuccessful = Json::parseFromStream(rbuilder, foo, &root, &errs);
-    if (!parsingSuccessful) {
-        // report to the user the failure and their locations in the document.
-        std::cout  << "Failed to parse configuration\n"
-                   << errs;
+    vl_lighthouse_samples samples = parse_csv_file(file_path);
+    if (!samples.empty())
+        optical->dump_pnp_positions(samples, model, normals);
+}
+
+static void room_setup() {
+    // before capturing for nothing
+    const vl_optical_module* optical = vl_optical_load();
+    if (!optical)
         return;
+
+    vl_model_points model;
+    vl_model_normals normals;
+    if (!read_sensor_model(&model, &normals))
+        return;
+
+    send_hmd_on();
+
+    // A few seconds of light, an OOTX frame takes about 3s per station.
+    CHECK(vl_driver_start_hmd_light_capture(driver, read_hmd_light), return);
+    while (driver->raw_light_samples.size() < 100000 && !should_exit)
+        CHECK(driver->poll(), break);
+    CHECK(vl_driver_stop_hmd_light_capture(driver), return);
+
+    vl_room_setup setup;
+    if (!optical->room_setup(driver->raw_light_samples, model, normals, &setup))
+        vl_error("Room setup failed, are both base stations in mode B and C visible?");
+}
+
+#define BENCH_TRACKERS 64
+#define BENCH_TICKS 5000
+
+static void print_bench_result(const char* name, std::chrono::steady_clock::duration time, size_t updates) {
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() / updates;
+    // trackers one core keeps up with at the 1000 Hz IMU rate
+    vl_info("%-16s %7.1f ns/update, %8.0f trackers per core", name, ns, 1e6 / ns);
+}
+
+// Synthetic IMU samples, a table each tracker runs through from its own
+// offset.
+#define BENCH_SAMPLES 1024
+
+// Fusion throughput on synthetic samples, how many trackers one core
+// could update at the IMU rate. The samples are of a device held
+// almost still, gyro noise and a slow turn on top of 1 g, so the
+// stillness detector, the bias learning and the gravity correction run
+// as they do on a worn headset.
+static void bench_fusion() {
+    std::mt19937 rng(42);
+    std::normal_distribution<double> noise(0.0, 1.0);
+
+    std::vector<Eigen::Vector3d> gyro(BENCH_SAMPLES), accel(BENCH_SAMPLES);
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        gyro[i] = Eigen::Vector3d(0.0, 0.05, 0.0) + Eigen::Vector3d(noise(rng), noise(rng), noise(rng)) * 0.005;
+        accel[i] = Eigen::Vector3d(0.0, VL_GRAVITY_EARTH, 0.0) + Eigen::Vector3d(noise(rng), noise(rng), noise(rng)) * 0.05;
     }
+    const double dt = 0.001;
+
+    std::vector<std::unique_ptr<vl_fusion>> fusions;
+    for (size_t i = 0; i < BENCH_TRACKERS; i++)
+        fusions.push_back(std::make_unique<vl_fusion>());
 
-    std::string my_encoding = root.get("mb_serial_number", "UTF-32" ).asString();
-    vl_info("mb_serial_number: %s", my_encoding.c_str());
+    auto start = std::chrono::steady_clock::now();
+    for (int tick = 0; tick < BENCH_TICKS; tick++) {
+        for (size_t i = 0; i < BENCH_TRACKERS; i++) {
+            size_t sample = (tick + i * 17) % BENCH_SAMPLES;
+            fusions[i]->update(dt, gyro[sample], accel[sample]);
+        }
+    }
+    print_bench_result("vl_fusion", std::chrono::steady_clock::now() - start,
+                       BENCH_TRACKERS * BENCH_TICKS);
+}
 
+#define BENCH_WATCHMAN_REPORTS 10000
+#define BENCH_WATCHMAN_PASSES 200
+
+// A mix like a controller in use: mostly IMU, with buttons, trigger
+// and trackpad in front of every 4th sample and a ping every 100th.
+static std::vector<std::vector<uint8_t>> synthesize_controller_reports() {
+    std::mt19937 rng(42);
+    std::vector<std::vector<uint8_t>> reports;
+
+    auto message = [&rng](uint8_t* slot, unsigned n) {
+        uint8_t* p = slot;
+        p[0] = rng();
+        p[2] = rng();
+        if (n % 100 == 0) {
+            p[3] = static_cast<uint8_t>(vl_controller_type::PING);
+            p[1] = 2 + 15;
+        } else if (n % 4 == 0) {
+            p[3] = 0xf7; // buttons, trigger and trackpad
+            p[4] = rng() & 0x3f;
+            p[5] = rng();
+            for (int i = 0; i < VL_WATCHMAN_TRACKPAD_SIZE; i++)
+                p[6 + i] = rng();
+            p[10] = static_cast<uint8_t>(vl_controller_type::IMU);
+            p[1] = 2 + 6 + 1 + VL_WATCHMAN_IMU_SIZE;
+            for (int i = 0; i < VL_WATCHMAN_IMU_SIZE; i++)
+                p[11 + i] = rng();
+            return;
+        } else {
+            p[3] = static_cast<uint8_t>(vl_controller_type::IMU);
+            p[1] = 2 + VL_WATCHMAN_IMU_SIZE;
+        }
+        for (int i = 4; i < p[1] + 2; i++)
+            p[i] = rng();
+    };
+
+    for (unsigned n = 0; n < BENCH_WATCHMAN_REPORTS; n++) {
+        bool two = n % 2;
+        std::vector<uint8_t> report(two ? 59 : 30, 0);
+        report[0] = static_cast<uint8_t>(two ? vl_report_id::CONTROLLER2 : vl_report_id::CONTROLLER1);
+        message(&report[1], n);
+        if (two)
+            message(&report[1 + VL_WATCHMAN_SLOT_SIZE], n + 1);
+        reports.push_back(std::move(report));
+    }
 
-    Json::Value modelPoints = root["lighthouse_config"]["modelPoints"];
+    return reports;
+}
 
-    vl_info("model points size: %u", modelPoints.size());
+// Parser throughput on the reports written by dump controller-raw, or
+// on synthetic ones without a recording.
+static void bench_watchman() {
+    std::vector<std::vector<uint8_t>> reports;
+
+    std::ifstream recording(CONTROLLER_RECORDING, std::ios::binary);
+    int size;
+    while ((size = recording.get()) != EOF) {
+        std::vector<uint8_t> report(size);
+        if (!recording.read((char*) report.data(), size))
+            break;
+        reports.push_back(std::move(report));
+    }
 
-    unsigned sensor_id = 0;
+    if (reports.empty()) {
+        vl_info("No %s, see dump controller-raw. Using synthetic reports.", CONTROLLER_RECORDING);
+        reports = synthesize_controller_reports();
+    } else {
+        vl_info("%zu reports from %s", reports.size(), CONTROLLER_RECORDING);
+    }
 
+    size_t bytes = 0;
+    for (const auto& report : reports)
+        bytes += report.size();
+
+    vl_watchman_parse_stats stats;
+    int64_t checksum = 0;
+    auto sink = [&checksum](const vl_watchman_event& event) {
+        checksum += event.ticks() + static_cast<int>(event.type);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCH_WATCHMAN_PASSES; pass++)
+        for (const auto& report : reports)
+            vl_watchman_parse(report.data(), report.size(), sink, &stats);
+    auto time = std::chrono::steady_clock::now() - start;
+
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    size_t count = reports.size() * BENCH_WATCHMAN_PASSES;
+    vl_info("%7.1f ns/report, %7.1f ns/event, %6.0f MB/s", ns / count,
+            ns / stats.events, bytes * BENCH_WATCHMAN_PASSES * 1e3 / ns);
+    vl_info("%llu events in %llu messages, %llu skipped, %llu malformed (checksum %lld)",
+            (unsigned long long) stats.events / BENCH_WATCHMAN_PASSES,
+            (unsigned long long) stats.messages / BENCH_WATCHMAN_PASSES,
+            (unsigned long long) stats.skipped / BENCH_WATCHMAN_PASSES,
+            (unsigned long long) stats.malformed / BENCH_WATCHMAN_PASSES,
+            (long long) checksum);
+}
 
-    std::map<unsigned, cv::Point3f> config_sensor_positions;
+// installed next to the sample server config, or in the source tree
+static const char* meshdata_paths[] = {
+    "/usr/share/osvrcore/sample-configs/HTC_Vive_meshdata.json",
+    "config/HTC_Vive_meshdata.json",
+};
 
-    for ( unsigned index = 0; index < modelPoints.size(); ++index ) {
-        // Iterates over the sequence elements.
+static bool read_file(const std::string& path, std::string* content) {
+    std::ifstream file(path);
+    if (!file.is_open())
+        return false;
+    std::stringstream stream;
+    stream << file.rdbuf();
+    *content = stream.str();
+    return true;
+}
 
-       Json::Value point = modelPoints[index];
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-       vl_info("%d: x %s y %s z %s", sensor_id, point[0].asString().c_str(), point[1].asString().c_str(), point[2].asString().c_str());
+// Convert a meshdata file to a distortion table, see vl_distortion_lut.
+static void convert_distortion(const std::string& json_path, const std::string& lut_path) {
+    std::string json;
+    CHECK(read_file(json_path, &json), vl_error("Could not read %s.", json_path.c_str()); return);
 
-       cv::Point3f p = cv::Point3f(
-               std::stod(point[0].asString()),
-               std::stod(point[1].asString()),
-               std::stod(point[2].asString()));
+    vl_distortion_samples samples;
+    CHECK(vl_distortion_parse_meshdata(json, &samples), return);
 
-       config_sensor_positions.insert(std::pair<unsigned, cv::Point3f>(sensor_id, p));
+    vl_distortion_lut lut;
+    CHECK(lut.build(samples), return);
+    CHECK(lut.save(lut_path), return);
+    vl_info("Wrote %ux%u distortion table %s.", lut.get_size(), lut.get_size(), lut_path.c_str());
+}
 
-       sensor_id++;
+#define BENCH_DISTORTION_POINTS (1 << 16)
+#define BENCH_DISTORTION_PASSES 100
+
+// Loading and lookups of the distortion table against parsing the
+// meshdata it is made from.
+static void bench_distortion() {
+    std::string json, json_path;
+    for (const char* path : meshdata_paths) {
+        if (read_file(path, &json)) {
+            json_path = path;
+            break;
+        }
+    }
+    CHECK(!json_path.empty(), vl_error("No HTC_Vive_meshdata.json found."); return);
+
+    auto start = std::chrono::steady_clock::now();
+    vl_distortion_samples samples;
+    CHECK(vl_distortion_parse_meshdata(json, &samples), return);
+    vl_info("%-16s %8.3f ms", "parse json", elapsed_ms(start));
+
+    start = std::chrono::steady_clock::now();
+    vl_distortion_lut built;
+    CHECK(built.build(samples), return);
+    vl_info("%-16s %8.3f ms", "build", elapsed_ms(start));
+
+    std::string lut_path = vl_cache_path("distortion-bench.bin");
+    CHECK(!lut_path.empty() && built.save(lut_path), return);
+
+    start = std::chrono::steady_clock::now();
+    vl_distortion_lut lut;
+    CHECK(lut.load(lut_path), return);
+    vl_info("%-16s %8.3f ms", "map table", elapsed_ms(start));
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> x(BENCH_DISTORTION_POINTS), y(BENCH_DISTORTION_POINTS);
+    std::vector<float> u(BENCH_DISTORTION_POINTS), v(BENCH_DISTORTION_POINTS);
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = uniform(rng);
+        y[i] = uniform(rng);
     }
 
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCH_DISTORTION_PASSES; pass++)
+        for (size_t i = 0; i < x.size(); i++)
+            lut.lookup(pass % VL_DISTORTION_EYES, pass % VL_DISTORTION_CHANNELS, x[i], y[i], &u[i], &v[i]);
+    vl_info("%-16s %8.2f ns/lookup", "lookup", elapsed_ms(start) * 1e6 / (x.size() * BENCH_DISTORTION_PASSES));
 
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < BENCH_DISTORTION_PASSES; pass++)
+        lut.evaluate(pass % VL_DISTORTION_EYES, pass % VL_DISTORTION_CHANNELS,
+                     x.data(), y.data(), x.size(), u.data(), v.data());
+    vl_info("%-16s %8.2f ns/lookup", "evaluate", elapsed_ms(start) * 1e6 / (x.size() * BENCH_DISTORTION_PASSES));
 
-    vl_lighthouse_samples samples = parse_csv_file(file_path);
-    if (!samples.empty())
-        dump_pnp_positions(&samples, config_sensor_positions);
+    remove(lut_path.c_str());
+}
+
+#define BENCH_POSE_READS 10000000
+#define BENCH_POSE_WAKEUPS 1000
+
+// The shared memory pose export as a local reader sees it: the cost
+// of a read while the writer publishes at the IMU rate, and the delay
+// from a publish to the reader waking up on its eventfd.
+static void bench_pose_shm() {
+    std::string name = "/vive-libre-pose-bench-" + std::to_string(getpid());
+    vl_pose_export writer;
+    CHECK(writer.open(name), return);
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    CHECK(fd >= 0, return);
+    void* map = mmap(nullptr, sizeof(vl_pose_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(map != MAP_FAILED, return);
+    const vl_pose_shm* shm = static_cast<const vl_pose_shm*>(map);
+
+    int connection;
+    int event_fd = vl_pose_shm_eventfd(name.c_str(), &connection);
+    CHECK(event_fd >= 0, munmap(map, sizeof(vl_pose_shm)); return);
+
+    std::atomic<bool> stop(false);
+    std::thread publisher([&writer, &stop] {
+        Eigen::Quaterniond orientation(Eigen::AngleAxisd(0.1, Eigen::Vector3d::UnitY()));
+        Eigen::Vector3d angular_velocity(0.1, 0.2, 0.3);
+        for (uint64_t ticks = 0; !stop; ticks += 48000) {
+            writer.publish(vl_pose_sample(ticks, orientation, angular_velocity, VL_POSE_SHM_STARTED));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    vl_pose_shm_sample sample;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_POSE_READS; i++)
+        vl_pose_shm_read(shm, &sample);
+    vl_info("%-16s %8.2f ns/read", "seqlock read", elapsed_ms(start) * 1e6 / BENCH_POSE_READS);
+
+    std::vector<double> delays;
+    uint64_t count;
+    while (delays.size() < BENCH_POSE_WAKEUPS && read(event_fd, &count, sizeof(count)) == sizeof(count)) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        vl_pose_shm_read(shm, &sample);
+        delays.push_back(((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - sample.host_time_ns) / 1e3);
+    }
+
+    stop = true;
+    publisher.join();
+    close(event_fd);
+    close(connection);
+    munmap(map, sizeof(vl_pose_shm));
+
+    CHECK(!delays.empty(), return);
+    std::sort(delays.begin(), delays.end());
+    vl_info("%-16s %8.1f us median, %.1f us 99th percentile", "eventfd wakeup",
+            delays[delays.size() / 2], delays[delays.size() * 99 / 100]);
 }
 
 static void send_hmd_off() {
     // turn the display off
     int hret = hid_send_feature_report(driver->hmd_device.handle,
                                    0,
-                                   vive_magic_power_off1);
+                                   vl_hmd_power_command_for(vl_hmd_power_mode::OFF1));
     vl_debug("power off magic 1: %d", hret);
 
     hret = hid_send_feature_report(driver->hmd_device.handle,
                                    0,
-                                   vive_magic_power_off2);
+                                   vl_hmd_power_command_for(vl_hmd_power_mode::OFF2));
     vl_debug("power off magic 2: %d", hret);
 }
 
@@ -249,7 +702,27 @@ static void send_controller_off() {
     for (int i = 0; i < 2; ++i)
         hid_send_feature_report(driver->watchman_dongle_device[i].handle,
                                 1,
-                                vive_controller_power_off);
+                                vl_controller_power_off());
+}
+
+// A burst faster than the dongle takes, to show the coalescing.
+static void send_haptic() {
+    const vl_haptic_pulse pulse = { 2000, 2000, 49 };
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while (std::chrono::steady_clock::now() < end && !should_exit) {
+        for (unsigned i = 0; i < VL_HAPTICS_CONTROLLERS; i++)
+            driver->haptics->pulse(i, pulse);
+        driver->haptics->poll(std::chrono::milliseconds(1));
+    }
+
+    // the last merged pulses
+    while (!should_exit && driver->haptics->poll(std::chrono::milliseconds(10)))
+        continue;
+
+    const vl_haptics_stats& stats = driver->haptics->stats;
+    vl_info("%llu pulses requested, %llu coalesced, %llu sent, %llu failed",
+            (unsigned long long) stats.requested, (unsigned long long) stats.coalesced,
+            (unsigned long long) stats.sent, (unsigned long long) stats.failed);
 }
 
 static void signal_interrupt_handler(int sig) {
@@ -271,21 +744,85 @@ void run(taskfun task) {
     delete(driver);
 }
 
+// Topics from a comma separated list of names, see
+// vl_daemon_topic_name(), "controller" for both and "all".
+static bool parse_topics(const std::string& list, uint32_t* topics) {
+    *topics = 0;
+    std::stringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (name == "all") {
+            *topics |= VL_DAEMON_ALL_TOPICS;
+            continue;
+        }
+        if (name == "controller") {
+            *topics |= VL_DAEMON_TOPIC_BIT(WATCHMAN1) | VL_DAEMON_TOPIC_BIT(WATCHMAN2);
+            continue;
+        }
+        unsigned topic = 0;
+        while (topic < static_cast<unsigned>(vl_daemon_topic::COUNT) &&
+               name != vl_daemon_topic_name(static_cast<vl_daemon_topic>(topic)))
+            topic++;
+        if (topic == static_cast<unsigned>(vl_daemon_topic::COUNT)) {
+            vl_error("Unknown topic %s", name.c_str());
+            return false;
+        }
+        *topics |= 1u << topic;
+    }
+    return true;
+}
+
+// Print the events of a running vivectl daemon.
+static void attach_daemon(const std::string& topic_list, uint32_t max_batch, uint32_t max_delay_us) {
+    uint32_t topics;
+    CHECK(parse_topics(topic_list, &topics), return);
+
+    vl_daemon_client client;
+    CHECK(client.connect(vl_daemon_subscribe(topics, max_batch, max_delay_us)), return);
+
+    signal(SIGINT, signal_interrupt_handler);
+    while (!should_exit) {
+        uint32_t dropped = 0;
+        CHECK(client.receive([](const vl_daemon_record& record) {
+            if (record.topic == vl_daemon_topic::MAINBOARD)
+                print_mainboard_event(record.mainboard);
+            else
+                print_merged_event(record.event);
+        }, &dropped), break);
+        if (dropped)
+            vl_warn("%u events dropped, the terminal is too slow.", dropped);
+    }
+}
+
 static std::map<std::string, taskfun> dump_commands {
     { "hmd-all", dump_hmd_all },
     { "hmd-mainboard", dump_hmd_mainboard },
     { "hmd-imu", dump_hmd_imu },
     { "hmd-light", dump_hmd_light },
     { "hmd-config", dump_config_hmd },
+    { "hmd-distortion", dump_config_distortion },
     { "controller", dump_controller },
+    { "controller-raw", dump_controller_raw },
+    { "controller-input", dump_controller_input },
     { "hmd-imu-pose", dump_hmd_imu_pose },
-    { "lighthouse-angles", dump_station_angle }
+    { "hmd-imu-heading", dump_hmd_imu_heading },
+    { "merged", dump_merged },
+    { "lighthouse-angles", dump_station_angle },
+    { "room-setup", room_setup }
+};
+
+static std::map<std::string, taskfun> bench_commands {
+    { "fusion", bench_fusion },
+    { "watchman", bench_watchman },
+    { "distortion", bench_distortion },
+    { "pose-shm", bench_pose_shm }
 };
 
 static std::map<std::string, taskfun> send_commands {
     { "hmd-on", send_hmd_on },
     { "hmd-off", send_hmd_off },
-    { "controller-off", send_controller_off }
+    { "controller-off", send_controller_off },
+    { "haptic", send_haptic }
 };
 
 static std::string commands_to_str(const std::map<std::string, taskfun>& commands) {
@@ -298,6 +835,7 @@ static std::string commands_to_str(const std::map<std::string, taskfun>& command
 static void print_usage() {
     std::string dmp_cmd_str = commands_to_str(dump_commands);
     std::string snd_cmd_str = commands_to_str(send_commands);
+    std::string bench_cmd_str = commands_to_str(bench_commands);
 
 #define USAGE "\
 Receive data from and send commands to Vive.\n\n\
@@ -306,9 +844,16 @@ usage: vivectl <command> <message>\n\n\
 %s\n\
  send\n\n\
 %s\n\
+ bench\n\n\
+%s\n\
+ distortion <meshdata.json> [<table.bin>]\n\n\
+ daemon\n\n\
+ attach <topics> [<max batch> [<max delay us>]]\n\n\
+  topics: all or a comma separated list of imu, light,\n\
+  controller, controller1, controller2 and mainboard\n\n\
 Example: vivectl dump hmd-imu"
 
-    vl_info(USAGE, dmp_cmd_str.c_str(), snd_cmd_str.c_str());
+    vl_info(USAGE, dmp_cmd_str.c_str(), snd_cmd_str.c_str(), bench_cmd_str.c_str());
 }
 
 static void argument_error(const char * arg) {
@@ -316,6 +861,19 @@ static void argument_error(const char * arg) {
     print_usage();
 }
 
+// A whole decimal number that fits 32 bit, no sign.
+static bool parse_uint32(const char* arg, uint32_t* value) {
+    if (arg[0] < '0' || arg[0] > '9')
+        return false;
+    char* end;
+    errno = 0;
+    unsigned long result = strtoul(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || result > UINT32_MAX)
+        return false;
+    *value = result;
+    return true;
+}
+
 taskfun _get_task_fun(char *argv[], const std::map<std::string, taskfun>& commands) {
     auto search = commands.find(std::string(argv[2]));
     if(search != commands.end()) {
@@ -329,7 +887,9 @@ taskfun _get_task_fun(char *argv[], const std::map<std::string, taskfun>& comman
 int main(int argc, char *argv[]) {
     taskfun task = nullptr;
 
-    if ( argc < 3 ) {
+    if (argc == 2 && compare(argv[1], "daemon")) {
+        run(run_daemon);
+    } else if ( argc < 3 ) {
         print_usage();
     } else {
         if (compare(argv[1], "dump")) {
@@ -338,6 +898,27 @@ int main(int argc, char *argv[]) {
         } else if (compare(argv[1], "send")) {
             task = _get_task_fun(argv, send_commands);
             run(task);
+        } else if (compare(argv[1], "bench")) {
+            // runs without a device
+            task = _get_task_fun(argv, bench_commands);
+            if (task)
+                task();
+        } else if (compare(argv[1], "distortion")) {
+            std::string json_path = argv[2];
+            std::string lut_path = argc > 3 ? argv[3] : json_path.substr(0, json_path.rfind(".json")) + ".bin";
+            convert_distortion(json_path, lut_path);
+        } else if (compare(argv[1], "attach")) {
+            // runs without a device, next to the daemon
+            uint32_t max_batch = 1;
+            uint32_t max_delay_us = 0;
+            for (int i = 3; i < argc && i < 5; i++) {
+                if (!parse_uint32(argv[i], i == 3 ? &max_batch : &max_delay_us)) {
+                    vl_error("Not a number: %s", argv[i]);
+                    print_usage();
+                    return 0;
+                }
+            }
+            attach_daemon(argv[2], max_batch, max_delay_us);
         } else if (compare(argv[1], "classify")) {
             std::string file_name = argv[2];
             dump_station_angle_from_csv(file_name);